@@ -6,116 +6,935 @@
 #include <unistd.h>
 #include <string.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <stdint.h>
+#include <errno.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
+#ifndef PODS // number of pods keys are spread over at first; build with -DPODS=<n> to change it
 #define PODS 256
+#endif
+#define MAX_SPLITS 8 // times the keys of a pod can be split in two
+#define MAX_PODS (PODS << MAX_SPLITS) // pods a store can split into
 #define KV_IN_PODS 256
-#define KEYSIZE 32
-#define VALSIZE 256
+#define KEYSIZE 32 // bytes of a key kept in its slot; the rest of a longer key is kept in its block
+#define POD_INDEX_SIZE (2 * KV_IN_PODS) // index entries per pod, so at most half are in use
+#define TAG_BLOCK 32 // tags compared at once; KV_IN_PODS must be a multiple of it
+#if KV_IN_PODS % TAG_BLOCK != 0
+#error KV_IN_PODS must be a multiple of TAG_BLOCK
+#endif
+#define STORE_READY 0x4b565331 // ready field of a store whose creator has set up its pods
+#define SIZE_CLASSES 30 // block sizes, from 32 bytes up in steps of half a doubling
+#define MAX_BLOCK ((uint64_t)48 << (SIZE_CLASSES / 2 - 1)) // size of the largest block, 768 KiB
+#ifndef ARENA_SIZE // bytes of blocks a new store has room for; build with -DARENA_SIZE=<n> to change it
+#define ARENA_SIZE ((uint64_t)1 << 20)
+#endif
+#ifndef MAX_STORE_SIZE // bytes a store can grow to; build with -DMAX_STORE_SIZE=<n> to change it
+#define MAX_STORE_SIZE ((uint64_t)16 << 30)
+#endif
 
-struct KV { // contains key and value strings
-  char key[KEYSIZE];
-  char value[VALSIZE];
-} KV;
+// a fingerprint in a pod's index, with the number of slots holding keys that have it
+struct KV_INDEX_ENTRY {
+  uint32_t fingerprint; // key_fingerprint of the keys; 0 if the entry is free
+  uint32_t count;
+} KV_INDEX_ENTRY;
 
+// a pod keeps the keys of its slots, and where their values are, in arrays aligned to cache
+// lines, so that comparing keys streams through dense key data. a slot keeps the first KEYSIZE
+// bytes of its key, zero padded, and compares them whole, as one vector. the value and the rest
+// of a longer key are kept in a block of the store's arena sized to fit them, so a KV takes
+// the memory its data needs and neither is ever cut short.
+// writers of a pod take its write_lock, shared by every process using the store, and make the
+// version of the slot they overwrite odd while they change it. readers take no lock and write
+// nothing: they read a slot, then check that its version is the even value it was before, and
+// read it again if not, so a reader never holds up a writer or another reader, is only held
+// up by a write to the very slot it reads, and never returns a half-written KV.
+// a lookup first checks the pod's index, an open-addressing table with linear probing, so a
+// miss reads a line or two of index instead of the pod. the slots of a key are then found by
+// comparing the tags of TAG_BLOCK slots at a time, and only slots whose tag matches have their
+// key compared. the index and tags are guarded the same way as a slot, by index_version,
+// which writers only hold odd while they add or drop a slot
 struct KV_POD { // container for KVs with index for FIFO updating
-  struct KV key_vals[KV_IN_PODS];
+  sem_t write_lock;
+  unsigned int index_version; // odd while a writer is changing the index or tags
   int insert_index;
+  int depth; // times the keys of the pod have been split in two
+  uint32_t bucket; // key_hash % (PODS << depth) of every key in the pod
+  uint64_t free_blocks[SIZE_CLASSES]; // blocks the pod's slots let go of, by size class
+  struct KV_INDEX_ENTRY index[POD_INDEX_SIZE] __attribute__((aligned(64)));
+  uint8_t tags[KV_IN_PODS] __attribute__((aligned(64))); // key_tag of the key in every slot, 0 if unused
+  uint64_t hashes[KV_IN_PODS]; // key_hash of the key in every slot
+  unsigned int versions[KV_IN_PODS]; // odd while a writer is changing the slot
+  uint32_t key_lengths[KV_IN_PODS];
+  uint32_t value_lengths[KV_IN_PODS];
+  uint64_t blocks[KV_IN_PODS]; // the value of every slot, then the rest of its key; 0 if unused
+  uint8_t classes[KV_IN_PODS]; // size class of every slot's block
+  char keys[KV_IN_PODS][KEYSIZE] __attribute__((aligned(64)));
 } KV_POD;
 
+// the store is one shared segment: this header, then an arena that pods and blocks are cut
+// from. both are named by their offset from the start of the segment, which is the same in
+// every process, wherever each maps it. a block a pod frees goes on the pod's free list of its
+// size class, for the pod's writers to reuse, and pages of the arena nothing has used yet take
+// no memory.
+// the store grows as it fills. when the arena has no room left, the segment is doubled, and
+// generation is bumped so that the other processes map the new part when they need it; the
+// whole of MAX_STORE_SIZE is reserved in every process when the store is opened, so the
+// segment grows in place and the store never moves.
+// keys pick their pod through a directory, by the low bits of their hash, so that a pod can be
+// split on its own, extendible hashing style: when a write would drop the last value of a key,
+// its pod holds more keys than it has room for, and the KVs of half its keys are moved to a
+// new pod. capacity follows the keys the store holds, one pod at a time, and nothing is held
+// up but the writers of the pod being split
 struct KV_STORE { // container for KV pods in shared store
-  struct KV_POD kv_pods[PODS];
+  unsigned int ready; // STORE_READY once the pods are set up; other processes wait for it
+  unsigned int generation; // bumped every time the segment grows
+  uint64_t size; // bytes in the segment
+  uint64_t arena_used; // offset of the first byte of the arena nothing has been cut from
+  int num_pods; // pods in use
+  int depth; // keys pick their pod by directory[key_hash % (PODS << depth)]
+  sem_t grow_lock; // held while the segment grows
+  sem_t split_lock; // held while a pod is split
+  uint64_t pods[MAX_PODS]; // offset of every pod in use
+  uint32_t directory[MAX_PODS]; // pod of every bucket of keys
 } KV_STORE;
 
+// a value of the store read in place: value points to its value_length bytes in the store's
+// segment, followed by a NUL. the value can be written over at any time, so it is only good if
+// kv_store_borrow_valid says so once the caller is done reading it; the segment is never
+// unmapped or moved while the store is open, so reading it is always safe
+struct KV_BORROW {
+  char* value;
+  uint32_t value_length;
+  struct KV_POD* pod; // pod of the slot the value is in
+  int pod_no;
+  int slot;
+  unsigned int version; // version of the slot when the value was found
+} KV_BORROW;
+
+// a key of a batch of reads or writes, with what the batch is sorted by
+struct KV_BATCH_ENTRY {
+  uint64_t key_hash;
+  int pod_no; // pod the key was in when the batch was planned
+  int position; // of the key in the batch
+} KV_BATCH_ENTRY;
+
 int hash(char*);
+uint64_t key_hash(char*);
+uint32_t key_fingerprint(uint64_t);
+uint8_t key_tag(uint32_t);
 int kv_store_create(char*);
 int kv_store_write(char*, char*);
 char *kv_store_read(char*);
 char **kv_store_read_all(char*);
+int kv_store_borrow(char*, struct KV_BORROW*);
+int kv_store_borrow_valid(struct KV_BORROW*);
+int kv_store_read_into(char*, char*, int);
+int kv_store_mget(char**, int, char**);
+int kv_store_mput(char**, char**, int);
 int kv_delete_db();
 
 struct KV_STORE* store; // contains the kv-store
-int pod_read_index[PODS]; // local index used for reading
+int pod_read_index[MAX_PODS]; // local index used for reading
 char* kv_store_name; // contains name given to kv-store in create; used for del
+int store_fd = -1; // the store's shm object, kept open to grow it
+uint64_t store_mapped; // bytes of the segment this process has mapped
+unsigned int store_generation; // generation of the segment this process last mapped
+
+// copies the first KEYSIZE bytes of key, of key_length, into padded, zeroing the rest, the form
+// slots keep keys in
+void pad_key(char* key, uint32_t key_length, char* padded) {
+  memset(padded, 0, KEYSIZE);
+  memcpy(padded, key, key_length < KEYSIZE ? key_length : KEYSIZE);
+}
+
+// bytes of the block a KV takes: its value and terminator, then what of its key is past KEYSIZE
+uint64_t block_size(uint64_t key_length, uint64_t value_length) {
+  return value_length + 1 + (key_length > KEYSIZE ? key_length - KEYSIZE : 0);
+}
+
+// bytes in the blocks of size_class
+uint64_t class_size(int size_class) {
+  return (uint64_t)(size_class % 2 ? 48 : 32) << size_class / 2;
+}
+
+// smallest size class whose blocks hold size bytes, which is at most MAX_BLOCK
+int size_class_of(uint64_t size) {
+  int size_class = 0;
+  while (class_size(size_class) < size) size_class++;
+  return size_class;
+}
+
+// maps whatever the segment has grown by since this process last mapped it, into the space
+// reserved for it
+void store_sync() {
+  unsigned int generation = __atomic_load_n(&store->generation, __ATOMIC_ACQUIRE);
+  if (generation == store_generation) return;
+  uint64_t size = __atomic_load_n(&store->size, __ATOMIC_RELAXED);
+  if (size > store_mapped) {
+    if (mmap((char*)store + store_mapped, size - store_mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             store_fd, store_mapped) == MAP_FAILED) {
+      return;
+    }
+    store_mapped = size;
+  }
+  store_generation = generation;
+}
+
+// returns a pointer to the length bytes at offset in the segment, mapping more of it if they
+// are past what this process has mapped, or NULL if they are past the end of the segment
+char* store_at(uint64_t offset, uint64_t length) {
+  if (offset > store_mapped || length > store_mapped - offset) {
+    store_sync();
+    if (offset > store_mapped || length > store_mapped - offset) return NULL;
+  }
+  return (char*)store + offset;
+}
+
+// grows the segment to at least needed bytes, doubling it at a time
+// returns 0 on success, -1 if it cannot grow that far
+int store_grow(uint64_t needed) {
+  if (needed > MAX_STORE_SIZE) return -1;
+  while (sem_wait(&store->grow_lock) < 0) {
+    if (errno != EINTR) return -1;
+  }
+  int result = 0;
+  uint64_t size = store->size;
+  if (size < needed) { // else another process grew it while this one waited
+    while (size < needed) size *= 2;
+    if (size > MAX_STORE_SIZE) size = MAX_STORE_SIZE;
+    if (ftruncate(store_fd, size) < 0) {
+      result = -1;
+    } else {
+      __atomic_store_n(&store->size, size, __ATOMIC_RELAXED);
+      __atomic_store_n(&store->generation, store->generation + 1, __ATOMIC_RELEASE);
+    }
+  }
+  sem_post(&store->grow_lock);
+  store_sync();
+  return result;
+}
+
+// cuts size bytes, aligned to align, off the arena, growing the segment if it has no room left
+// the arena is shared by every pod, so writers of other pods may be cutting from it too
+// returns the offset of the bytes, or 0 if the segment cannot grow to hold them
+uint64_t arena_cut(uint64_t size, uint64_t align) {
+  uint64_t used = __atomic_load_n(&store->arena_used, __ATOMIC_RELAXED);
+  while (1) {
+    uint64_t start = (used + align - 1) & ~(align - 1);
+    if (start + size > __atomic_load_n(&store->size, __ATOMIC_ACQUIRE)) {
+      if (store_grow(start + size) < 0) return 0;
+      used = __atomic_load_n(&store->arena_used, __ATOMIC_RELAXED);
+    } else if (__atomic_compare_exchange_n(&store->arena_used, &used, start + size, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return store_at(start, size) != NULL ? start : 0;
+    }
+  }
+}
+
+// takes a block off pod's free list of size_class; the caller holds the pod's write_lock
+// returns the offset of the block, or 0 if the list is empty
+uint64_t block_pop(struct KV_POD* pod, int size_class) {
+  uint64_t block = pod->free_blocks[size_class];
+  if (block != 0) {
+    memcpy(&pod->free_blocks[size_class], store_at(block, sizeof(uint64_t)), sizeof(uint64_t));
+  }
+  return block;
+}
+
+// takes a block of at least size_class for pod and sets *block_class to its class: one the pod
+// freed of size_class if there is one, else one cut from the arena, else a larger one the pod
+// freed; the caller holds the pod's write_lock
+// returns the offset of the block, or 0 if there is no room for it
+uint64_t block_alloc(struct KV_POD* pod, int size_class, int* block_class) {
+  uint64_t block = block_pop(pod, size_class);
+  *block_class = size_class;
+  if (block != 0 || (block = arena_cut(class_size(size_class), 16)) != 0) return block;
+  for (*block_class = size_class + 1; *block_class < SIZE_CLASSES; (*block_class)++) {
+    if ((block = block_pop(pod, *block_class)) != 0) return block;
+  }
+  return 0;
+}
+
+// copies value, of value_length, and what of key, of key_length, is past KEYSIZE into block
+void block_fill(uint64_t block, char* key, uint64_t key_length, char* value, uint64_t value_length) {
+  char* data = store_at(block, block_size(key_length, value_length));
+  memcpy(data, value, value_length + 1);
+  if (key_length > KEYSIZE) {
+    memcpy(data + value_length + 1, key + KEYSIZE, key_length - KEYSIZE);
+  }
+}
+
+// puts block, of size_class, on pod's free list; the caller holds the pod's write_lock
+void block_free(struct KV_POD* pod, uint64_t block, int size_class) {
+  memcpy(store_at(block, sizeof(uint64_t)), &pod->free_blocks[size_class], sizeof(uint64_t));
+  pod->free_blocks[size_class] = block;
+}
+
+// pod a key whose hash is key_hash_value belongs in
+int pod_of(uint64_t key_hash_value) {
+  int depth = __atomic_load_n(&store->depth, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&store->directory[key_hash_value % ((uint64_t)PODS << depth)], __ATOMIC_RELAXED);
+}
+
+// returns pod pod_no of the store
+struct KV_POD* pod_at(int pod_no) {
+  return (struct KV_POD*)store_at(store->pods[pod_no], sizeof(struct KV_POD));
+}
+
+// returns 1 if the padded keys a and b are the same, 0 if not
+// both are compared whole, in one 32-byte vector compare where the machine has one
+int keys_equal(char* a, char* b) {
+#if defined(__AVX2__)
+  __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)a), _mm256_loadu_si256((__m256i*)b));
+  return _mm256_movemask_epi8(equal) == -1;
+#elif defined(__SSE2__)
+  __m128i low = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)a), _mm_loadu_si128((__m128i*)b));
+  __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(a + 16)), _mm_loadu_si128((__m128i*)(b + 16)));
+  return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xFFFF;
+#else
+  return memcmp(a, b, KEYSIZE) == 0;
+#endif
+}
+
+// returns a mask with bit i set for every one of the TAG_BLOCK tags from tags that is tag
+uint32_t match_tags(uint8_t* tags, uint8_t tag) {
+#if defined(__AVX2__)
+  __m256i equal = _mm256_cmpeq_epi8(_mm256_load_si256((__m256i*)tags), _mm256_set1_epi8(tag));
+  return (uint32_t)_mm256_movemask_epi8(equal);
+#elif defined(__SSE2__)
+  __m128i pattern = _mm_set1_epi8(tag);
+  uint32_t low = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i*)tags), pattern));
+  uint32_t high = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i*)(tags + 16)), pattern));
+  return low | high << 16;
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < TAG_BLOCK; i++) {
+    mask |= (uint32_t)(tags[i] == tag) << i;
+  }
+  return mask;
+#endif
+}
+
+// finds the value in slot of pod if the slot's key is key, of key_length, both as they were at
+// one moment, and sets *version to the slot's version then and *value_length to the value's
+// length; prefix is key as pad_key leaves it. a key is checked before the version, so slots
+// that do not match cost no more than a compare: a slot being rewritten that fails to match is
+// taken as read just before the write
+// returns a pointer to the value in its block, which is only good while the slot's version is
+// still *version, or NULL if the key did not match
+char* slot_value(struct KV_POD* pod, int slot, char* prefix, char* key, uint32_t key_length,
+                 unsigned int* version, uint32_t* value_length) {
+  char* data;
+  if (!keys_equal(prefix, pod->keys[slot])) return NULL;
+  do {
+    data = NULL;
+    while ((*version = __atomic_load_n(&pod->versions[slot], __ATOMIC_ACQUIRE)) & 1) {
+      sched_yield();
+    }
+    uint64_t block = pod->blocks[slot];
+    *value_length = pod->value_lengths[slot];
+    uint64_t size = block_size(key_length, *value_length);
+    // a torn read may give any block and length, so they are bounded before they are used
+    int matched = keys_equal(prefix, pod->keys[slot]) && pod->key_lengths[slot] == key_length &&
+                  block != 0 && size <= MAX_BLOCK && (data = store_at(block, size)) != NULL;
+    if (matched && key_length > KEYSIZE) {
+      matched = memcmp(data + *value_length + 1, key + KEYSIZE, key_length - KEYSIZE) == 0;
+    }
+    if (!matched) data = NULL;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&pod->versions[slot], __ATOMIC_RELAXED) != *version);
+  return data;
+}
+
+// returns 1 if slot of pod has not been written since its version was version, so what was read
+// of it since is good, 0 if it has
+int slot_unchanged(struct KV_POD* pod, int slot, unsigned int version) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&pod->versions[slot], __ATOMIC_RELAXED) == version;
+}
+
+// USER IS RESPONSIBLE FOR FREEING RETURNED CHAR*
+// returns a copy of the value in slot of pod if the slot's key is key, as slot_value finds it
+// returns NULL if the key did not match
+char* read_slot(struct KV_POD* pod, int slot, char* prefix, char* key, uint32_t key_length) {
+  unsigned int version;
+  uint32_t value_length;
+  char* data;
+  while ((data = slot_value(pod, slot, prefix, key, key_length, &version, &value_length)) != NULL) {
+    char* value = malloc(value_length + 1);
+    memcpy(value, data, value_length);
+    value[value_length] = '\0';
+    if (slot_unchanged(pod, slot, version)) return value;
+    free(value);
+  }
+  return NULL;
+}
+
+// waits until no writer is changing pod's index, and returns the version to check reads against
+unsigned int index_read_begin(struct KV_POD* pod) {
+  unsigned int version;
+  while ((version = __atomic_load_n(&pod->index_version, __ATOMIC_ACQUIRE)) & 1) {
+    sched_yield();
+  }
+  return version;
+}
+
+// returns 1 if a writer changed pod's index since index_read_begin returned version, so what
+// was read from it may be inconsistent and has to be read again; 0 if the read is good
+int index_read_retry(struct KV_POD* pod, unsigned int version) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&pod->index_version, __ATOMIC_RELAXED) != version;
+}
+
+// marks pod's index as being changed, or done changing; the caller holds the write_lock
+void index_write(struct KV_POD* pod, int done) {
+  __atomic_store_n(&pod->index_version, pod->index_version + 1, done ? __ATOMIC_RELEASE : __ATOMIC_RELAXED);
+  if (!done) __atomic_thread_fence(__ATOMIC_RELEASE); // readers must see the odd version before any change
+}
+
+// finds fingerprint in pod's index
+// returns the position of its entry in pod->index, or -1 if no key in the pod has it
+int index_find(struct KV_POD* pod, uint32_t fingerprint) {
+  int position = fingerprint % POD_INDEX_SIZE;
+  for (int n = 0; n < POD_INDEX_SIZE && pod->index[position].fingerprint != 0; n++) {
+    if (pod->index[position].fingerprint == fingerprint) return position;
+    position = (position + 1) % POD_INDEX_SIZE;
+  }
+  return -1;
+}
+
+// frees the entry at position in pod's index, moving later entries of its probe run back so
+// that lookups never stop short at the freed entry
+void index_remove(struct KV_POD* pod, int position) {
+  int next = position;
+  pod->index[position].fingerprint = 0;
+  while (pod->index[next = (next + 1) % POD_INDEX_SIZE].fingerprint != 0) {
+    int home = pod->index[next].fingerprint % POD_INDEX_SIZE;
+    // the entry at next can fill the hole unless its home lies cyclically in (position, next]
+    int stays = position <= next ? (home > position && home <= next) : (home > position || home <= next);
+    if (!stays) {
+      pod->index[position] = pod->index[next];
+      pod->index[next].fingerprint = 0;
+      position = next;
+    }
+  }
+}
+
+// counts a slot holding a key with fingerprint in pod's index; the caller holds the pod's
+// write_lock and has marked the index as being changed
+void index_add(struct KV_POD* pod, uint32_t fingerprint) {
+  int entry = index_find(pod, fingerprint);
+  if (entry >= 0) {
+    pod->index[entry].count++;
+    return;
+  }
+  for (entry = fingerprint % POD_INDEX_SIZE; pod->index[entry].fingerprint != 0; entry = (entry + 1) % POD_INDEX_SIZE);
+  pod->index[entry].count = 1;
+  pod->index[entry].fingerprint = fingerprint;
+}
+
+// takes a slot holding a key with fingerprint out of pod's index, as index_add counts it in
+// returns 1 if it was the last slot with fingerprint, 0 if not
+int index_drop(struct KV_POD* pod, uint32_t fingerprint) {
+  int entry = index_find(pod, fingerprint);
+  if (--pod->index[entry].count > 0) return 0;
+  index_remove(pod, entry);
+  return 1;
+}
+
+// finds up to max slots of pod whose key starts with prefix, as pad_key leaves it, and has
+// key_length bytes, going round the pod from slot from, and stores them in slots in that order.
+// tags are compared TAG_BLOCK at a time and only the slots whose tag matches have their key
+// compared; keys read here may be mid-write, and the rest of a longer key is not compared, so
+// the caller checks the slots again with read_slot
+// returns the number of slots found
+int find_slots(struct KV_POD* pod, char* prefix, uint32_t key_length, uint8_t tag, int from, int* slots, int max) {
+  int num_slots = 0;
+  int block = from - from % TAG_BLOCK;
+  uint32_t mask = match_tags(&pod->tags[block], tag) & (~0u << from % TAG_BLOCK);
+  // every block once, then the part of the first block before from
+  for (int n = 0; n <= KV_IN_PODS / TAG_BLOCK; n++) {
+    if (n == KV_IN_PODS / TAG_BLOCK) mask &= ~(~0u << from % TAG_BLOCK);
+    for (; mask != 0; mask &= mask - 1) {
+      int slot = block + __builtin_ctz(mask);
+      if (pod->key_lengths[slot] == key_length && keys_equal(prefix, pod->keys[slot])) {
+        slots[num_slots++] = slot;
+        if (num_slots == max) return num_slots;
+      }
+    }
+    block = (block + TAG_BLOCK) % KV_IN_PODS;
+    mask = match_tags(&pod->tags[block], tag);
+  }
+  return num_slots;
+}
+
+// moves the KVs of the keys of source that belong in target to target, oldest first, and the
+// rest up to the start of source, so its free slots are the next it writes to. readers of any
+// slot of source look again; the caller holds its write_lock and has marked its index as being
+// changed, and no reader can see target yet
+void move_kvs(struct KV_POD* source, struct KV_POD* target) {
+  struct KV_POD* old = malloc(sizeof(struct KV_POD));
+  for (int slot = 0; slot < KV_IN_PODS; slot++) {
+    __atomic_store_n(&source->versions[slot], source->versions[slot] + 1, __ATOMIC_RELAXED);
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(old, source, sizeof(struct KV_POD));
+  memset(source->tags, 0, sizeof(source->tags));
+  memset(source->blocks, 0, sizeof(source->blocks));
+  int kept = 0;
+  for (int age = 0; age < KV_IN_PODS; age++) {
+    int slot = (old->insert_index + age) % KV_IN_PODS;
+    if (old->tags[slot] == 0) continue;
+    struct KV_POD* pod = source;
+    int to = kept;
+    if (old->hashes[slot] % ((uint64_t)PODS << target->depth) == target->bucket) {
+      index_drop(source, key_fingerprint(old->hashes[slot]));
+      index_add(target, key_fingerprint(old->hashes[slot]));
+      pod = target;
+      to = target->insert_index++;
+    } else {
+      kept++;
+    }
+    memcpy(pod->keys[to], old->keys[slot], KEYSIZE);
+    pod->key_lengths[to] = old->key_lengths[slot];
+    pod->value_lengths[to] = old->value_lengths[slot];
+    pod->blocks[to] = old->blocks[slot];
+    pod->classes[to] = old->classes[slot];
+    pod->hashes[to] = old->hashes[slot];
+    pod->tags[to] = old->tags[slot];
+  }
+  source->insert_index = kept;
+  for (int slot = 0; slot < KV_IN_PODS; slot++) {
+    __atomic_store_n(&source->versions[slot], source->versions[slot] + 1, __ATOMIC_RELEASE);
+  }
+  free(old);
+}
+
+// splits pod pod_no in two, if its keys have been split depth times so far, moving the KVs of
+// the keys whose next bit of hash is set to a new pod. only the metadata of the KVs moves, not
+// their blocks, so the pod is held for no longer than a few writes would hold it
+// returns 0 if the pod was split, by this writer or another, -1 if it cannot be
+int split_pod(int pod_no, int depth) {
+  while (sem_wait(&store->split_lock) < 0) {
+    if (errno != EINTR) return -1;
+  }
+  struct KV_POD* source = pod_at(pod_no);
+  uint64_t offset = 0;
+  if (source->depth == depth && depth < MAX_SPLITS && store->num_pods < MAX_PODS) {
+    if (depth == store->depth) { // the directory doubles first, each bucket becoming two
+      uint64_t buckets = (uint64_t)PODS << store->depth;
+      memcpy(&store->directory[buckets], store->directory, buckets * sizeof(uint32_t));
+      __atomic_store_n(&store->depth, store->depth + 1, __ATOMIC_RELEASE);
+    }
+    offset = arena_cut(sizeof(struct KV_POD), 64);
+  }
+  if (offset == 0 || sem_wait(&source->write_lock) < 0) {
+    sem_post(&store->split_lock);
+    return source->depth != depth ? 0 : -1;
+  }
+
+  // no key maps to the new pod until the directory says so, so it is filled in without guards
+  int target_no = store->num_pods;
+  struct KV_POD* target = (struct KV_POD*)store_at(offset, sizeof(struct KV_POD));
+  sem_init(&target->write_lock, 1, 1);
+  target->depth = depth + 1;
+  target->bucket = source->bucket + ((uint32_t)PODS << depth);
+  index_write(source, 0);
+  move_kvs(source, target);
+  uint64_t buckets = (uint64_t)PODS << store->depth;
+  for (uint64_t bucket = target->bucket; bucket < buckets; bucket += (uint64_t)PODS << target->depth) {
+    __atomic_store_n(&store->directory[bucket], target_no, __ATOMIC_RELAXED);
+  }
+  store->pods[target_no] = offset;
+  store->num_pods++;
+  source->depth = depth + 1;
+  index_write(source, 1);
+  sem_post(&source->write_lock);
+  sem_post(&store->split_lock);
+  return 0;
+}
 
 // USER IS RESPONSIBLE FOR FREEING RETURNED CHAR**
+// returns the values of key, oldest first, or NULL if there are none. values equal to the
+// oldest one are left out, but other values that repeat are all returned
 char** kv_store_read_all(char* key) {
-  char **value_list = malloc((KV_IN_PODS + 1) * sizeof(char*));
-  int pod_no = hash(key);
-  int tmp_index = pod_read_index[pod_no];
-  pod_read_index[pod_no] = (store->kv_pods[pod_no].insert_index) % KV_IN_PODS;
+  size_t key_length = strlen(key);
+  if (key_length > MAX_BLOCK) return NULL; // too long to have been written
+  uint64_t key_hash_value = key_hash(key);
+  uint32_t fingerprint = key_fingerprint(key_hash_value);
+  char prefix[KEYSIZE];
+  pad_key(key, key_length, prefix);
+  int slots[KV_IN_PODS];
+  char **value_list;
+  int val_list_index;
+
+  while (1) {
+    int pod_no = pod_of(key_hash_value);
+    struct KV_POD* pod = pod_at(pod_no);
+    int depth = __atomic_load_n(&pod->depth, __ATOMIC_ACQUIRE);
+    unsigned int version = index_read_begin(pod);
+    int num_slots = 0;
+    if (index_find(pod, fingerprint) >= 0) {
+      int oldest = pod->insert_index % KV_IN_PODS;
+      num_slots = find_slots(pod, prefix, key_length, key_tag(fingerprint), oldest, slots, KV_IN_PODS);
+    }
+    if (index_read_retry(pod, version)) continue;
+    if (num_slots == 0) {
+      if (pod_of(key_hash_value) != pod_no) continue;
+      return NULL;
+    }
 
-  char *init_val = kv_store_read(key);
-  int init_val_index = pod_read_index[pod_no] - 1;
-  int val_list_index = 0;
+    value_list = malloc((num_slots + 1) * sizeof(char*));
+    val_list_index = 0;
+    for (int i = 0; i < num_slots; i++) {
+      char* value = read_slot(pod, slots[i], prefix, key, key_length);
+      if (value == NULL) continue; // overwritten since
+      if (val_list_index > 0 && strcmp(value_list[0], value) == 0) {
+        free(value);
+        continue;
+      }
+      value_list[val_list_index++] = value;
+    }
+    // a split may have moved the KVs before they were read, to the new pod or in this one
+    if (pod_of(key_hash_value) == pod_no && __atomic_load_n(&pod->depth, __ATOMIC_ACQUIRE) == depth) break;
+    for (int i = 0; i < val_list_index; i++) {
+      free(value_list[i]);
+    }
+    free(value_list);
+  }
 
-  if (init_val == NULL) {
+  if (val_list_index == 0) {
+    free(value_list);
     return NULL;
-  } else {
-    value_list[val_list_index++] = init_val;
   }
+  value_list[val_list_index] = NULL;
+  return value_list;
+}
 
-  char *temp_val;
-  if (strlen(key) > KEYSIZE-1) key[KEYSIZE-1] = '\0';
+// returns 1 if a KV of key_length and value_length bytes fits the largest block, 0 if not
+int kv_fits(size_t key_length, size_t value_length) {
+  return key_length <= MAX_BLOCK && value_length <= MAX_BLOCK && block_size(key_length, value_length) <= MAX_BLOCK;
+}
 
-  for (int i = pod_read_index[pod_no]; i != init_val_index; i = (i+1) % KV_IN_PODS) {
-    if (strcmp(key, (store->kv_pods[pod_no].key_vals[i].key)) == 0) {
-      temp_val = malloc(strlen(store->kv_pods[pod_no].key_vals[i].value) + 1);
-      strcpy(temp_val, (store->kv_pods[pod_no].key_vals[i].value));
-      if (strcmp(init_val, temp_val) != 0) {
-        value_list[val_list_index++] = temp_val;
-      } else {
-        free(temp_val);
-      }
+// locks the pod a key whose hash is key_hash_value belongs in, and sets *pod_no to its number
+// returns the pod, or NULL if it could not be locked
+struct KV_POD* lock_pod_of(uint64_t key_hash_value, int* pod_no) {
+  while (1) {
+    *pod_no = pod_of(key_hash_value);
+    struct KV_POD* pod = pod_at(*pod_no);
+    while (sem_wait(&pod->write_lock) < 0) {
+      if (errno != EINTR) return NULL;
     }
+    if (pod_of(key_hash_value) == *pod_no) return pod;
+    sem_post(&pod->write_lock); // split while this writer waited, so the key may have moved
   }
-  value_list[val_list_index] = NULL;
+}
 
-  pod_read_index[pod_no] = tmp_index;
-  return value_list;
+// sets *evicted to the index entry of the key in the slot the next write to pod goes in, or to
+// -1 if the slot is free; the caller holds the pod's write_lock
+// returns 1 if the slot holds the last value of its key, so the pod holds more keys than it has
+// room for and is to be split before it is written to, 0 if not
+int pod_crowded(struct KV_POD* pod, int* evicted) {
+  int slot = pod->insert_index % KV_IN_PODS;
+  *evicted = pod->tags[slot] != 0 ? index_find(pod, key_fingerprint(pod->hashes[slot])) : -1;
+  return *evicted >= 0 && pod->index[*evicted].count == 1;
 }
 
-int kv_store_write(char* key, char* value) {
-  if (strlen(key) > KEYSIZE-1) key[KEYSIZE-1] = '\0';
-  if (strlen(value) > VALSIZE-1) value[VALSIZE-1] = '\0';
-  int pod_no = hash(key);
-
-  int new_index = (store->kv_pods[pod_no].insert_index);
-  struct KV new_kv;
-  strcpy(new_kv.key, key);
-  strcpy(new_kv.value, value);
-  memcpy(&(store->kv_pods[pod_no].key_vals[(new_index++)%KV_IN_PODS]), &new_kv, sizeof(new_kv));
-  memcpy(&(store->kv_pods[pod_no].insert_index), &new_index, sizeof(int));
+// writes value, of value_length, for key, of key_length, whose hash is key_hash_value, over the
+// oldest KV of pod, whose index entry pod_crowded set evicted to; the caller holds the pod's
+// write_lock and has checked that the KV fits
+// returns 0 on success, -1 if there is no block free for the KV, not even the one of the KV
+// written over; nothing is written then
+int pod_write(struct KV_POD* pod, int evicted, char* key, size_t key_length, char* value, size_t value_length,
+              uint64_t key_hash_value) {
+  int slot = pod->insert_index % KV_IN_PODS;
+  int size_class = size_class_of(block_size(key_length, value_length));
+  uint32_t fingerprint = key_fingerprint(key_hash_value);
+  char prefix[KEYSIZE];
+  pad_key(key, key_length, prefix);
+
+  int block_class;
+  uint64_t block = block_alloc(pod, size_class, &block_class);
+  if (block == 0 && (pod->blocks[slot] == 0 || pod->classes[slot] < size_class)) return -1;
+  if (block != 0) { // no slot has the block yet, so it is filled in before any reader can look at it
+    block_fill(block, key, key_length, value, value_length);
+  }
+
+  if (evicted >= 0) { // drop the slot's old key, which no reader may match while it changes
+    index_write(pod, 0);
+    if (--pod->index[evicted].count == 0) {
+      index_remove(pod, evicted);
+    }
+    pod->tags[slot] = 0;
+    index_write(pod, 1);
+  }
+
+  unsigned int version = pod->versions[slot];
+  __atomic_store_n(&pod->versions[slot], version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE); // readers must see the odd version before any change
+  if (block == 0) { // there is no room elsewhere, but the slot's own block fits the KV
+    block = pod->blocks[slot];
+    block_class = pod->classes[slot];
+    block_fill(block, key, key_length, value, value_length);
+  } else if (pod->blocks[slot] != 0) {
+    block_free(pod, pod->blocks[slot], pod->classes[slot]);
+  }
+  memcpy(pod->keys[slot], prefix, KEYSIZE);
+  pod->key_lengths[slot] = key_length;
+  pod->value_lengths[slot] = value_length;
+  pod->blocks[slot] = block;
+  pod->classes[slot] = block_class;
+  __atomic_store_n(&pod->versions[slot], version + 2, __ATOMIC_RELEASE);
+
+  index_write(pod, 0);
+  index_add(pod, fingerprint);
+  pod->hashes[slot] = key_hash_value;
+  pod->tags[slot] = key_tag(fingerprint);
+  __atomic_store_n(&pod->insert_index, pod->insert_index + 1, __ATOMIC_RELEASE);
+  index_write(pod, 1);
   return 0;
 }
 
-char* kv_store_read(char* key) {
-  if (strlen(key) > KEYSIZE-1) key[KEYSIZE-1] = '\0';
-  int pod_no = hash(key);
-  pod_read_index[pod_no] = pod_read_index[pod_no] % KV_IN_PODS;
-  int original_read_index = pod_read_index[pod_no];
-
-  //initial test- need to move read index past original so control enters subsequent while loop
-  if (strcmp(key, (store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]].key)) == 0) {
-    char* value = malloc(strlen(store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]].value) + 1);
-    strcpy(value, (store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]].value));
-    pod_read_index[pod_no]++;
-    return value;
-  }
-
-  while (original_read_index != ++pod_read_index[pod_no]%KV_IN_PODS) {
-    pod_read_index[pod_no] = pod_read_index[pod_no] % KV_IN_PODS;
-    if (strcmp(key, (store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]].key)) == 0) {
-      char* value = malloc(strlen(store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]].value) + 1);
-      strcpy(value, (store->kv_pods[pod_no].key_vals[pod_read_index[pod_no]++].value));
+// writes value for key over the oldest KV of key's pod, splitting the pod first if that is the
+// last value of its key, so that the store grows with the keys it holds
+// returns 0 on success, -1 if key and value need a block larger than MAX_BLOCK, if there is no
+// block free for them, not even the one of the KV written over, or if the pod could not be
+// locked; nothing is written then
+int kv_store_write(char* key, char* value) {
+  size_t key_length = strlen(key), value_length = strlen(value);
+  if (!kv_fits(key_length, value_length)) return -1;
+  uint64_t key_hash_value = key_hash(key);
+
+  struct KV_POD* pod;
+  int pod_no, evicted, split_failed = 0;
+  while ((pod = lock_pod_of(key_hash_value, &pod_no)) != NULL) {
+    if (!pod_crowded(pod, &evicted) || split_failed) {
+      int result = pod_write(pod, evicted, key, key_length, value, value_length, key_hash_value);
+      sem_post(&pod->write_lock);
+      return result;
+    }
+    int depth = pod->depth;
+    sem_post(&pod->write_lock);
+    split_failed = split_pod(pod_no, depth) < 0;
+  }
+  return -1;
+}
+
+// finds the next value of key, whose hash is key_hash_value, starting from where the last read
+// of its pod left off, and sets borrow to it, without moving where the next read starts
+// returns 0 if key has a value, -1 if it has none
+int find_value(char* key, uint64_t key_hash_value, struct KV_BORROW* borrow) {
+  size_t key_length = strlen(key);
+  if (key_length > MAX_BLOCK) return -1; // too long to have been written
+  uint32_t fingerprint = key_fingerprint(key_hash_value);
+  char prefix[KEYSIZE];
+  pad_key(key, key_length, prefix);
+
+  struct KV_POD* pod = NULL;
+  int pod_no = -1, depth = 0, from = 0, passed = 0;
+  while (passed < KV_IN_PODS) {
+    int current = pod_of(key_hash_value);
+    if (current != pod_no || __atomic_load_n(&pod->depth, __ATOMIC_ACQUIRE) != depth) {
+      // the first look, or the pod was split since and its KVs moved
+      pod_no = current;
+      pod = pod_at(pod_no);
+      depth = __atomic_load_n(&pod->depth, __ATOMIC_ACQUIRE);
+      from = pod_read_index[pod_no] % KV_IN_PODS;
+      passed = 0;
+    }
+    unsigned int version = index_read_begin(pod);
+    int found, num_slots = 0;
+    if (index_find(pod, fingerprint) >= 0) { // else no slot can hold key, and no tag is compared
+      num_slots = find_slots(pod, prefix, key_length, key_tag(fingerprint), from, &found, 1);
+    }
+    if (index_read_retry(pod, version)) continue;
+    if (pod_of(key_hash_value) != pod_no) continue;
+    if (num_slots == 0) return -1;
+    borrow->value = slot_value(pod, found, prefix, key, key_length, &borrow->version, &borrow->value_length);
+    if (borrow->value != NULL) {
+      borrow->pod = pod;
+      borrow->pod_no = pod_no;
+      borrow->slot = found;
+      return 0;
+    }
+    // overwritten since, or a longer key that only starts the same; look on past it
+    passed += (found - from + KV_IN_PODS) % KV_IN_PODS + 1;
+    from = (found + 1) % KV_IN_PODS;
+  }
+  return -1;
+}
+
+// USER IS RESPONSIBLE FOR FREEING RETURNED CHAR*
+// returns a copy of the next value of key, whose hash is key_hash_value, and moves the read of
+// its pod past it; NULL if there is none
+char* read_value(char* key, uint64_t key_hash_value) {
+  struct KV_BORROW borrow;
+  while (find_value(key, key_hash_value, &borrow) == 0) {
+    char* value = malloc(borrow.value_length + 1);
+    memcpy(value, borrow.value, borrow.value_length);
+    value[borrow.value_length] = '\0';
+    if (kv_store_borrow_valid(&borrow)) {
+      pod_read_index[borrow.pod_no] = borrow.slot + 1;
       return value;
     }
+    free(value); // written over while it was copied; look again
   }
   return NULL;
 }
 
+// USER IS RESPONSIBLE FOR FREEING RETURNED CHAR*
+// returns the next value of key, starting from where the last read of its pod left off, so
+// that reading a key again and again goes through its values in turn; NULL if there is none
+char* kv_store_read(char* key) {
+  return read_value(key, key_hash(key));
+}
+
+// sets borrow to the next value of key, as kv_store_read would return it, but in place in the
+// store instead of copied, so nothing is allocated. the caller reads the value and then checks
+// kv_store_borrow_valid, borrowing it again if that says it was written over meanwhile
+// returns 0 if key has a value, -1 if it has none
+int kv_store_borrow(char* key, struct KV_BORROW* borrow) {
+  if (find_value(key, key_hash(key), borrow) < 0) return -1;
+  pod_read_index[borrow->pod_no] = borrow->slot + 1;
+  return 0;
+}
+
+// returns 1 if the value borrow points to has not been written over since it was borrowed, so
+// what the caller read of it is good, 0 if it has
+int kv_store_borrow_valid(struct KV_BORROW* borrow) {
+  return slot_unchanged(borrow->pod, borrow->slot, borrow->version);
+}
+
+// copies the next value of key, as kv_store_read would return it, and a terminator into buf,
+// of size bytes, so nothing is allocated. a value that does not fit is not copied and is not
+// read past, so it can be read again into a larger buffer
+// returns the length of the value, which did not fit if it is size or more, or -1 if key has
+// no value
+int kv_store_read_into(char* key, char* buf, int size) {
+  struct KV_BORROW borrow;
+  while (find_value(key, key_hash(key), &borrow) == 0) {
+    if ((int)borrow.value_length >= size) return borrow.value_length;
+    memcpy(buf, borrow.value, borrow.value_length);
+    buf[borrow.value_length] = '\0';
+    if (kv_store_borrow_valid(&borrow)) {
+      pod_read_index[borrow.pod_no] = borrow.slot + 1;
+      return borrow.value_length;
+    }
+  }
+  return -1;
+}
+
+// USER IS RESPONSIBLE FOR FREEING RETURNED STRUCT KV_BATCH_ENTRY*
+// hashes the count keys of a batch, and returns them in the order given, with room after them
+// for batch_group to sort them in. the lines a lookup of each key reads first, the head of its
+// pod and its index entry, are prefetched as the key is hashed, so they are on their way in
+// while the rest are hashed. a pod may be split before the batch is done, so the pods are
+// only a plan, and every key is looked up again when it is read or written
+struct KV_BATCH_ENTRY* batch_hash(char** keys, int count) {
+  struct KV_BATCH_ENTRY* batch = malloc(2 * count * sizeof(struct KV_BATCH_ENTRY));
+  for (int i = 0; i < count; i++) {
+    batch[i].key_hash = key_hash(keys[i]);
+    batch[i].pod_no = pod_of(batch[i].key_hash);
+    batch[i].position = i;
+    struct KV_POD* pod = pod_at(batch[i].pod_no);
+    __builtin_prefetch(pod);
+    __builtin_prefetch(&pod->index[key_fingerprint(batch[i].key_hash) % POD_INDEX_SIZE]);
+  }
+  return batch;
+}
+
+// sorts the count keys of batch, as batch_hash returns them, by pod, keeping the order they
+// were given in within a pod, so that the values of a key are still written in turn. they are
+// sorted a byte of pod number at a time, each pass keeping the order of the last, so a store
+// of PODS pods takes one pass
+void batch_group(struct KV_BATCH_ENTRY* batch, int count) {
+  struct KV_BATCH_ENTRY* from = batch;
+  struct KV_BATCH_ENTRY* to = batch + count;
+  int last_pod = 0;
+  for (int i = 0; i < count; i++) {
+    if (batch[i].pod_no > last_pod) last_pod = batch[i].pod_no;
+  }
+  for (int shift = 0; last_pod >> shift != 0; shift += 8) {
+    int starts[256 + 1] = {0};
+    for (int i = 0; i < count; i++) {
+      starts[(from[i].pod_no >> shift & 0xFF) + 1]++;
+    }
+    for (int digit = 1; digit <= 256; digit++) {
+      starts[digit] += starts[digit - 1];
+    }
+    for (int i = 0; i < count; i++) {
+      to[starts[from[i].pod_no >> shift & 0xFF]++] = from[i];
+    }
+    struct KV_BATCH_ENTRY* sorted = to;
+    to = from;
+    from = sorted;
+  }
+  if (from != batch) memcpy(batch, from, count * sizeof(struct KV_BATCH_ENTRY));
+}
+
+// USER IS RESPONSIBLE FOR FREEING THE VALUES RETURNED
+// sets values[i] to the next value of keys[i], as kv_store_read would return it, or to NULL if
+// there is none, for every one of the count keys, hashing them all first. readers take no
+// lock, so the keys are read in the order given rather than a pod at a time
+// returns the number of keys that had a value
+int kv_store_mget(char** keys, int count, char** values) {
+  if (count <= 0) return 0;
+  struct KV_BATCH_ENTRY* batch = batch_hash(keys, count);
+  int found = 0;
+  for (int i = 0; i < count; i++) {
+    int position = batch[i].position;
+    values[position] = read_value(keys[position], batch[i].key_hash);
+    found += values[position] != NULL;
+  }
+  free(batch);
+  return found;
+}
+
+// writes values[i] for keys[i], for every one of the count keys, as kv_store_write would, but a
+// pod at a time: the keys are hashed first, and a pod is locked once for all of them in it,
+// unless it has to be split part way. the writes of a key are done in the order given
+// returns the number of KVs written; those kv_store_write would fail on are not
+int kv_store_mput(char** keys, char** values, int count) {
+  if (count <= 0) return 0;
+  struct KV_BATCH_ENTRY* batch = batch_hash(keys, count);
+  batch_group(batch, count);
+  struct KV_POD* pod = NULL; // the pod whose write_lock is held, if any
+  int pod_no = -1, written = 0;
+  for (int i = 0; i < count; i++) {
+    char* key = keys[batch[i].position];
+    char* value = values[batch[i].position];
+    size_t key_length = strlen(key), value_length = strlen(value);
+    if (!kv_fits(key_length, value_length)) continue;
+    uint64_t key_hash_value = batch[i].key_hash;
+    int evicted, split_failed = 0;
+    while (1) {
+      // the pod held cannot be split, so if the key is in it, it stays there
+      if (pod == NULL || pod_of(key_hash_value) != pod_no) {
+        if (pod != NULL) sem_post(&pod->write_lock);
+        if ((pod = lock_pod_of(key_hash_value, &pod_no)) == NULL) break;
+      }
+      if (!pod_crowded(pod, &evicted) || split_failed) {
+        written += pod_write(pod, evicted, key, key_length, value, value_length, key_hash_value) == 0;
+        break;
+      }
+      int depth = pod->depth;
+      sem_post(&pod->write_lock);
+      pod = NULL;
+      split_failed = split_pod(pod_no, depth) < 0;
+    }
+  }
+  if (pod != NULL) sem_post(&pod->write_lock);
+  free(batch);
+  return written;
+}
+
 int kv_delete_db() {
   if (kv_store_name == NULL) return (-1); // if no store open, impossible to delete
-  munmap(store, sizeof(*store));
+  munmap(store, MAX_STORE_SIZE);
+  close(store_fd);
   char* file_name = malloc((strlen(kv_store_name)+20) * sizeof(char));
   sprintf(file_name, "/dev/shm/%s", kv_store_name);
   int exit_code = remove(file_name);
@@ -123,46 +942,117 @@ int kv_delete_db() {
   return exit_code;
 }
 
+// opens the store called name, creating it if there is none
+// returns 0 on success, -1 on failure
 int kv_store_create(char* name) {
+  // the segment is mapped into space reserved for all it can grow to, so it can grow in place
+  char* reserved = mmap(NULL, MAX_STORE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    printf("mmap error\n");
+    return -1;
+  }
+  uint64_t initial_size = sizeof(KV_STORE) + PODS * (sizeof(KV_POD) + 64) + ARENA_SIZE;
+  initial_size = (initial_size + (1 << 20) - 1) & ~(uint64_t)((1 << 20) - 1); // whole MBs, so the segment grows by whole pages
   int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRWXU);
   if (fd > -1) { //if new store
-    store = mmap(NULL, sizeof(KV_STORE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    ftruncate(fd, sizeof(KV_STORE));
-    close(fd);
+    ftruncate(fd, initial_size);
+    store = mmap(reserved, initial_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (store == MAP_FAILED) {
+      printf("mmap error\n");
+      close(fd);
+      munmap(reserved, MAX_STORE_SIZE);
+      return -1;
+    }
+    store_fd = fd;
+    store_mapped = initial_size;
+    store_generation = 0;
+    store->size = initial_size;
+    store->arena_used = sizeof(KV_STORE);
+    sem_init(&store->grow_lock, 1, 1);
+    sem_init(&store->split_lock, 1, 1);
     for (int i = 0; i < PODS; i++) {
-      store->kv_pods[i].insert_index = 0;
+      store->pods[i] = arena_cut(sizeof(KV_POD), 64);
+      store->directory[i] = i;
+      sem_init(&pod_at(i)->write_lock, 1, 1);
+      pod_at(i)->bucket = i;
     }
+    store->num_pods = PODS;
+    __atomic_store_n(&store->ready, STORE_READY, __ATOMIC_RELEASE);
     kv_store_name = name;
   }
   else { //if store exists try
     fd = shm_open(name, O_CREAT | O_RDWR, S_IRWXU);
     if (fd < 0) { //if shm_open still doesn't work
       printf("shm_open error\n");
+      munmap(reserved, MAX_STORE_SIZE);
       return -1;
     }
-    store = mmap(NULL, sizeof(KV_STORE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    ftruncate(fd, sizeof(KV_STORE));
-    close(fd);
-
+    // the creator may still be setting up the store; a store never set up is given up on
+    struct stat stat_buf;
+    int waited = 0;
+    while ((fstat(fd, &stat_buf) < 0 || stat_buf.st_size < (off_t)sizeof(KV_STORE)) && waited++ < 1000) {
+      usleep(1000);
+    }
+    store = waited > 1000 ? MAP_FAILED :
+            mmap(reserved, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    while (store != MAP_FAILED && __atomic_load_n(&store->ready, __ATOMIC_ACQUIRE) != STORE_READY && waited++ < 1000) {
+      usleep(1000);
+    }
+    if (store == MAP_FAILED || waited > 1000) {
+      printf("kv-store %s was never set up\n", name);
+      close(fd);
+      munmap(reserved, MAX_STORE_SIZE);
+      return -1;
+    }
+    store_fd = fd;
+    store_mapped = stat_buf.st_size;
+    store_generation = store->generation - 1; // so the whole of the segment is mapped now
+    store_sync();
     kv_store_name = name;
   }
 
-  if (fd < 0) { //if shm_open still doesn't work
-    printf("shm_open error\n");
-    return -1;
-  }
+  memset(pod_read_index, 0, sizeof(pod_read_index));
+  return 0;
+}
 
-  for (int i = 0; i < PODS; i++) {
-    pod_read_index[i] = 0;
+// multiplies a and b out to 128 bits and folds the halves together, the mixing step of wyhash
+static uint64_t mum(uint64_t a, uint64_t b) {
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// 64-bit hash of a key
+// the key is read once, a byte at a time, and folded in 8 bytes at a time, so every byte
+// and its position matter and keys that only permute the same bytes hash apart
+uint64_t key_hash(char* key) {
+  const uint64_t p0 = 0xa0761d6478bd642full, p1 = 0xe7037ed1a0b428dbull, p2 = 0x8ebc6af09c88c6e3ull;
+  uint64_t h = p0, word = 0;
+  int length = 0;
+  for (; key[length] != '\0'; length++) {
+    word |= (uint64_t)(unsigned char)key[length] << (8 * (length & 7));
+    if ((length & 7) == 7) {
+      h = mum(h ^ word, p1);
+      word = 0;
+    }
   }
+  h = mum(h ^ word ^ p2, p1 ^ length);
+  return mum(h, h ^ p0);
+}
 
-  return 0;
+// tag of a key in its pod's index: the high bits of its hash, which do not pick the pod
+uint32_t key_fingerprint(uint64_t key_hash_value) {
+  uint32_t fingerprint = key_hash_value >> 32;
+  return fingerprint != 0 ? fingerprint : 1;
 }
 
+// tag of a key in its pod's tags array: the top byte of its fingerprint, never 0, which marks
+// an unused slot
+uint8_t key_tag(uint32_t fingerprint) {
+  uint8_t tag = fingerprint >> 24;
+  return tag != 0 ? tag : 1;
+}
+
+// pod a key belongs in
 int hash(char* key) {
-  int hash = 0;
-  for (int index = 0; index < strlen(key); index++) {
-    hash += key[index];
-  }
-  return (hash%PODS);
+  return store != NULL ? pod_of(key_hash(key)) : (int)(key_hash(key) % PODS);
 }
@@ -6,32 +6,128 @@
 #include <unistd.h>
 #include <string.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <stdint.h>
 
+#ifndef PODS // number of pods keys are spread over at first; build with -DPODS=<n> to change it
 #define PODS 256
+#endif
+#define MAX_SPLITS 8 // times the keys of a pod can be split in two
+#define MAX_PODS (PODS << MAX_SPLITS) // pods a store can split into
 #define KV_IN_PODS 256
-#define KEYSIZE 32
-#define VALSIZE 256
+#define KEYSIZE 32 // bytes of a key kept in its slot; the rest of a longer key is kept in its block
+#define POD_INDEX_SIZE (2 * KV_IN_PODS) // index entries per pod, so at most half are in use
+#define TAG_BLOCK 32 // tags compared at once; KV_IN_PODS must be a multiple of it
+#define STORE_READY 0x4b565331 // ready field of a store whose creator has set up its pods
+#define SIZE_CLASSES 30 // block sizes, from 32 bytes up in steps of half a doubling
+#define MAX_BLOCK ((uint64_t)48 << (SIZE_CLASSES / 2 - 1)) // size of the largest block, 768 KiB
+#ifndef ARENA_SIZE // bytes of blocks a new store has room for; build with -DARENA_SIZE=<n> to change it
+#define ARENA_SIZE ((uint64_t)1 << 20)
+#endif
+#ifndef MAX_STORE_SIZE // bytes a store can grow to; build with -DMAX_STORE_SIZE=<n> to change it
+#define MAX_STORE_SIZE ((uint64_t)16 << 30)
+#endif
 
-struct KV { // contains key and value strings
-  char key[KEYSIZE];
-  char value[VALSIZE];
+// a fingerprint in a pod's index, with the number of slots holding keys that have it
+struct KV_INDEX_ENTRY {
+  uint32_t fingerprint; // key_fingerprint of the keys; 0 if the entry is free
+  uint32_t count;
 };
 
+// a pod keeps the keys of its slots, and where their values are, in arrays aligned to cache
+// lines, so that comparing keys streams through dense key data. a slot keeps the first KEYSIZE
+// bytes of its key, zero padded, and compares them whole, as one vector. the value and the rest
+// of a longer key are kept in a block of the store's arena sized to fit them, so a KV takes
+// the memory its data needs and neither is ever cut short.
+// writers of a pod take its write_lock, shared by every process using the store, and make the
+// version of the slot they overwrite odd while they change it. readers take no lock and write
+// nothing: they read a slot, then check that its version is the even value it was before, and
+// read it again if not, so a reader never holds up a writer or another reader, is only held
+// up by a write to the very slot it reads, and never returns a half-written KV.
+// a lookup first checks the pod's index, an open-addressing table with linear probing, so a
+// miss reads a line or two of index instead of the pod. the slots of a key are then found by
+// comparing the tags of TAG_BLOCK slots at a time, and only slots whose tag matches have their
+// key compared. the index and tags are guarded the same way as a slot, by index_version,
+// which writers only hold odd while they add or drop a slot
 struct KV_POD { // container for KVs with index for FIFO updating
-  struct KV key_vals[KV_IN_PODS];
+  sem_t write_lock;
+  unsigned int index_version; // odd while a writer is changing the index or tags
   int insert_index;
+  int depth; // times the keys of the pod have been split in two
+  uint32_t bucket; // key_hash % (PODS << depth) of every key in the pod
+  uint64_t free_blocks[SIZE_CLASSES]; // blocks the pod's slots let go of, by size class
+  struct KV_INDEX_ENTRY index[POD_INDEX_SIZE] __attribute__((aligned(64)));
+  uint8_t tags[KV_IN_PODS] __attribute__((aligned(64))); // key_tag of the key in every slot, 0 if unused
+  uint64_t hashes[KV_IN_PODS]; // key_hash of the key in every slot
+  unsigned int versions[KV_IN_PODS]; // odd while a writer is changing the slot
+  uint32_t key_lengths[KV_IN_PODS];
+  uint32_t value_lengths[KV_IN_PODS];
+  uint64_t blocks[KV_IN_PODS]; // the value of every slot, then the rest of its key; 0 if unused
+  uint8_t classes[KV_IN_PODS]; // size class of every slot's block
+  char keys[KV_IN_PODS][KEYSIZE] __attribute__((aligned(64)));
 };
 
+// the store is one shared segment: this header, then an arena that pods and blocks are cut
+// from. both are named by their offset from the start of the segment, which is the same in
+// every process, wherever each maps it. a block a pod frees goes on the pod's free list of its
+// size class, for the pod's writers to reuse, and pages of the arena nothing has used yet take
+// no memory.
+// the store grows as it fills. when the arena has no room left, the segment is doubled, and
+// generation is bumped so that the other processes map the new part when they need it; the
+// whole of MAX_STORE_SIZE is reserved in every process when the store is opened, so the
+// segment grows in place and the store never moves.
+// keys pick their pod through a directory, by the low bits of their hash, so that a pod can be
+// split on its own, extendible hashing style: when a write would drop the last value of a key,
+// its pod holds more keys than it has room for, and the KVs of half its keys are moved to a
+// new pod. capacity follows the keys the store holds, one pod at a time, and nothing is held
+// up but the writers of the pod being split
 struct KV_STORE { // container for KV pods in shared store
-  struct KV_POD kv_pods[PODS];
+  unsigned int ready; // STORE_READY once the pods are set up; other processes wait for it
+  unsigned int generation; // bumped every time the segment grows
+  uint64_t size; // bytes in the segment
+  uint64_t arena_used; // offset of the first byte of the arena nothing has been cut from
+  int num_pods; // pods in use
+  int depth; // keys pick their pod by directory[key_hash % (PODS << depth)]
+  sem_t grow_lock; // held while the segment grows
+  sem_t split_lock; // held while a pod is split
+  uint64_t pods[MAX_PODS]; // offset of every pod in use
+  uint32_t directory[MAX_PODS]; // pod of every bucket of keys
+};
+
+// a value of the store read in place: value points to its value_length bytes in the store's
+// segment, followed by a NUL. the value can be written over at any time, so it is only good if
+// kv_store_borrow_valid says so once the caller is done reading it; the segment is never
+// unmapped or moved while the store is open, so reading it is always safe
+struct KV_BORROW {
+  char* value;
+  uint32_t value_length;
+  struct KV_POD* pod; // pod of the slot the value is in
+  int pod_no;
+  int slot;
+  unsigned int version; // version of the slot when the value was found
+};
+
+// a key of a batch of reads or writes, with what the batch is sorted by
+struct KV_BATCH_ENTRY {
+  uint64_t key_hash;
+  int pod_no; // pod the key was in when the batch was planned
+  int position; // of the key in the batch
 };
 
 int hash(char*);
+uint64_t key_hash(char*);
+uint32_t key_fingerprint(uint64_t);
+uint8_t key_tag(uint32_t);
 int kv_store_create(char*);
 int kv_store_write(char*, char*);
 char *kv_store_read(char*);
 char **kv_store_read_all(char*);
+int kv_store_borrow(char*, struct KV_BORROW*);
+int kv_store_borrow_valid(struct KV_BORROW*);
+int kv_store_read_into(char*, char*, int);
+int kv_store_mget(char**, int, char**);
+int kv_store_mput(char**, char**, int);
 int kv_delete_db();
 
-struct KV_STORE* store; // contains the kv-store
-int pod_read_index[PODS]; // local index used for reading
+extern struct KV_STORE* store; // contains the kv-store
+extern int pod_read_index[MAX_PODS]; // local index used for reading
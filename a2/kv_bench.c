@@ -0,0 +1,172 @@
+// Times kv-store reads that miss, reads that hit, borrows, read_intos, read_alls and writes on a store whose pods are full,
+// and the same hits and writes done in batches, with mget and mput
+// The store is filled with values of a set of distinct keys until every slot is taken, so a
+// miss has a whole pod to rule out, as it would on a store that has been in use for a while.
+//
+// usage: kv_bench [-k keys] [-n ops] [-s size] [-b batch]
+//   -k  distinct keys written to fill the store (default 20000)
+//   -n  ops timed per workload (default 200000)
+//   -s  bytes in every value written (default 24)
+//   -b  keys per mget and mput (default 100)
+// Build with gcc -O2 -march=native -o kv_bench kv_bench.c a2_lib.c -lrt -pthread
+#include <time.h>
+#include "a2_lib.h"
+
+double now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+void print_result(char* workload, double elapsed_ns, int ops) {
+  printf("%-10s %10.0f ns/op %12.0f ops/s\n", workload, elapsed_ns/ops, ops/(elapsed_ns/1e9));
+}
+
+int main(int argc, char** argv) {
+  int num_keys = 20000, ops = 200000, value_size = 24, batch = 100;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) num_keys = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) ops = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) value_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) batch = atoi(argv[++i]);
+    else {
+      printf("usage: kv_bench [-k keys] [-n ops] [-s size] [-b batch]\n");
+      return 1;
+    }
+  }
+  if (num_keys <= 0 || ops <= 0 || value_size < 24 || batch <= 0) {
+    printf("usage: kv_bench [-k keys] [-n ops] [-s size] [-b batch], with a size of at least 24\n");
+    return 1;
+  }
+
+  char name[64];
+  sprintf(name, "kv_bench_%d", (int)getpid());
+  if (kv_store_create(name) < 0) return 1;
+  char key[32];
+  char* value = malloc(value_size + 1);
+  memset(value, '.', value_size);
+  value[value_size] = '\0';
+  for (int i = 0; i < PODS * KV_IN_PODS; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    value[sprintf(value, "%d of %d", i / num_keys, i % num_keys)] = '.'; // numbered, padded to value_size
+    if (kv_store_write(key, value) < 0) {
+      printf("store full after %d writes\n", i);
+      return 1;
+    }
+  }
+  printf("%d keys over %d pods of %d slots, %d-byte values, %d ops each\n", num_keys, PODS, KV_IN_PODS, value_size, ops);
+  printf("%d pods, %.1f MB of the store in use\n", store->num_pods, store->arena_used / 1e6);
+
+  long found = 0;
+  double start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "missing%d", i);
+    char* read = kv_store_read(key);
+    found += read != NULL;
+    free(read);
+  }
+  print_result("read miss", now_ns() - start, ops);
+
+  start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    char* read = kv_store_read(key);
+    found += read != NULL;
+    free(read);
+  }
+  print_result("read hit", now_ns() - start, ops);
+
+  // batches go through the keys in the same order as the single calls before them
+  char** batch_keys = malloc(batch * sizeof(char*));
+  char** batch_reads = malloc(batch * sizeof(char*));
+  char** batch_values = malloc(batch * sizeof(char*));
+  for (int j = 0; j < batch; j++) {
+    batch_keys[j] = malloc(32);
+    batch_values[j] = malloc(value_size + 1);
+    memset(batch_values[j], '.', value_size);
+    batch_values[j][value_size] = '\0';
+  }
+  long batched = 0;
+  start = now_ns();
+  for (int i = 0; i < ops; i += batch) {
+    int count = ops - i < batch ? ops - i : batch;
+    for (int j = 0; j < count; j++) {
+      sprintf(batch_keys[j], "key%d", (i + j) % num_keys);
+    }
+    batched += kv_store_mget(batch_keys, count, batch_reads);
+    for (int j = 0; j < count; j++) {
+      free(batch_reads[j]);
+    }
+  }
+  print_result("mget", now_ns() - start, ops);
+
+  struct KV_BORROW borrow;
+  start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    while (kv_store_borrow(key, &borrow) == 0) {
+      int numbered = borrow.value[0] >= '0' && borrow.value[0] <= '9';
+      if (kv_store_borrow_valid(&borrow)) {
+        found += numbered;
+        break;
+      }
+    }
+  }
+  print_result("borrow", now_ns() - start, ops);
+
+  char* buffer = malloc(value_size + 1);
+  start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    found += kv_store_read_into(key, buffer, value_size + 1) == value_size;
+  }
+  print_result("read_into", now_ns() - start, ops);
+
+  start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    char** all = kv_store_read_all(key);
+    for (int j = 0; all != NULL && all[j] != NULL; j++) {
+      free(all[j]);
+    }
+    free(all);
+  }
+  print_result("read_all", now_ns() - start, ops);
+
+  start = now_ns();
+  for (int i = 0; i < ops; i++) {
+    sprintf(key, "key%d", i % num_keys);
+    value[sprintf(value, "%d", i)] = '.';
+    kv_store_write(key, value);
+  }
+  print_result("write", now_ns() - start, ops);
+
+  start = now_ns();
+  for (int i = 0; i < ops; i += batch) {
+    int count = ops - i < batch ? ops - i : batch;
+    for (int j = 0; j < count; j++) {
+      sprintf(batch_keys[j], "key%d", (i + j) % num_keys);
+      batch_values[j][sprintf(batch_values[j], "%d", i + j)] = '.';
+    }
+    batched += kv_store_mput(batch_keys, batch_values, count);
+  }
+  print_result("mput", now_ns() - start, ops);
+
+  if (found != 3 * ops) {
+    printf("%ld reads of %d found a value; expected only the hits, borrows and read_intos to\n", found, 4 * ops);
+  }
+  if (batched != 2 * ops) {
+    printf("%ld of %d batched reads and writes found or wrote a value; expected all to\n", batched, 2 * ops);
+  }
+  for (int j = 0; j < batch; j++) {
+    free(batch_keys[j]);
+    free(batch_values[j]);
+  }
+  free(batch_keys);
+  free(batch_reads);
+  free(batch_values);
+  free(buffer);
+  free(value);
+  kv_delete_db();
+  return 0;
+}
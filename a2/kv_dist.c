@@ -0,0 +1,100 @@
+// Reports how a key set spreads over the pods of the kv-store, to check that pod load is balanced
+// Keys are read one per line from the file given, or from stdin.
+//
+// usage: kv_dist [-p pods] [-a] [-v] [file]
+//   -p  pod count to report on (default: PODS, the count a store starts with)
+//   -a  also report the byte-sum hash the store used before, for comparison
+//   -v  print the number of keys in every pod
+// Build with gcc -o kv_dist kv_dist.c a2_lib.c -lrt -lm -pthread
+#include <math.h>
+#include "a2_lib.h"
+
+#define MAX_LINE 1024
+
+// the old pod function: the sum of the key's bytes
+uint64_t byte_sum_hash(char* key) {
+  uint64_t sum = 0;
+  for (int i = 0; key[i] != '\0'; i++) {
+    sum += key[i];
+  }
+  return sum;
+}
+
+// prints load statistics of keys spread over pods by hash_function
+void report(char* label, uint64_t (*hash_function)(char*), char** keys, int num_keys, int pods, int verbose) {
+  int* loads = calloc(pods, sizeof(int));
+  for (int i = 0; i < num_keys; i++) {
+    loads[hash_function(keys[i]) % pods]++;
+  }
+
+  int empty = 0, min = num_keys, max = 0;
+  double mean = (double)num_keys / pods, chi_square = 0;
+  for (int i = 0; i < pods; i++) {
+    if (loads[i] == 0) empty++;
+    if (loads[i] < min) min = loads[i];
+    if (loads[i] > max) max = loads[i];
+    chi_square += (loads[i] - mean) * (loads[i] - mean) / mean;
+  }
+  // a uniform hash gives a chi-square near pods - 1, within a few times sqrt(2*(pods - 1))
+  double deviations = (chi_square - (pods - 1)) / sqrt(2.0 * (pods - 1));
+
+  printf("%s: %d keys over %d pods\n", label, num_keys, pods);
+  printf("  load min %d, mean %.2f, max %d (%.2fx mean), %d empty pods\n", min, mean, max, max / mean, empty);
+  printf("  chi-square %.1f for %d degrees of freedom: %.1f standard deviations from uniform%s\n",
+         chi_square, pods - 1, deviations, fabs(deviations) > 3 ? " - UNBALANCED" : "");
+  printf("  keys past the %d slots of the fullest pod: %d\n", KV_IN_PODS, max > KV_IN_PODS ? max - KV_IN_PODS : 0);
+  if (verbose) {
+    for (int i = 0; i < pods; i++) {
+      printf("%6d%c", loads[i], i % 10 == 9 || i == pods - 1 ? '\n' : ' ');
+    }
+  }
+  free(loads);
+}
+
+int main(int argc, char** argv) {
+  int pods = PODS, compare = 0, verbose = 0;
+  char* path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) pods = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-a") == 0) compare = 1;
+    else if (strcmp(argv[i], "-v") == 0) verbose = 1;
+    else path = argv[i];
+  }
+  if (pods <= 1) {
+    printf("usage: kv_dist [-p pods] [-a] [-v] [file]\n");
+    return 1;
+  }
+  FILE* in = path == NULL ? stdin : fopen(path, "r");
+  if (in == NULL) {
+    printf("Could not open %s\n", path);
+    return 1;
+  }
+
+  int capacity = 1024, num_keys = 0;
+  char** keys = malloc(capacity * sizeof(char*));
+  char line[MAX_LINE];
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0') continue;
+    if (num_keys == capacity) {
+      capacity *= 2;
+      keys = realloc(keys, capacity * sizeof(char*));
+    }
+    keys[num_keys++] = strdup(line);
+  }
+  if (in != stdin) fclose(in);
+  if (num_keys == 0) {
+    printf("no keys\n");
+    return 1;
+  }
+
+  report("key_hash", key_hash, keys, num_keys, pods, verbose);
+  if (compare) {
+    report("byte sum", byte_sum_hash, keys, num_keys, pods, verbose);
+  }
+  for (int i = 0; i < num_keys; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,117 @@
+// CRC32C for the SFS block checksums; see crc32c.h
+#include "crc32c.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reflected Castagnoli polynomial
+
+static uint32_t table[8][256]; // slicing-by-8 tables for the software fallback
+static int table_ready = 0;
+
+static void build_table() {
+  for (int i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+    }
+    table[0][i] = crc;
+  }
+  for (int i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      table[t][i] = (table[t-1][i] >> 8) ^ table[0][table[t-1][i] & 0xFF];
+    }
+  }
+  table_ready = 1;
+}
+
+// software crc32c, 8 bytes per step
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *p, size_t length) {
+  if (!table_ready) build_table();
+  while (length >= 8) {
+    uint32_t low, high;
+    memcpy(&low, p, 4);
+    memcpy(&high, p + 4, 4);
+    low ^= crc; // little-endian
+    crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+        ^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+#define STRIDE 336 // bytes per stream when three streams are interleaved; 3 strides fit a block
+
+static uint32_t shift_table[4][256]; // advances a crc over STRIDE zero bytes, a byte at a time
+
+// crc32c with the SSE4.2 crc32 instruction, 8 bytes per instruction
+// the instruction has a latency of 3 cycles but a throughput of 1 per cycle, so long inputs
+// are cut into three streams that are crc'd side by side and then combined: the crc of
+// a stream followed by another is the first one's crc advanced over the second's length,
+// xored with the second one's crc started from 0
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t length) {
+  uint64_t crc0 = crc;
+  while (length >= 3*STRIDE) {
+    uint64_t crc1 = 0, crc2 = 0;
+    for (int i = 0; i < STRIDE; i += 8) {
+      uint64_t word0, word1, word2;
+      memcpy(&word0, p + i, 8);
+      memcpy(&word1, p + STRIDE + i, 8);
+      memcpy(&word2, p + 2*STRIDE + i, 8);
+      crc0 = _mm_crc32_u64(crc0, word0);
+      crc1 = _mm_crc32_u64(crc1, word1);
+      crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    for (int s = 0; s < 2; s++) {
+      uint32_t c = (uint32_t)crc0;
+      crc0 = shift_table[0][c & 0xFF] ^ shift_table[1][(c >> 8) & 0xFF] ^ shift_table[2][(c >> 16) & 0xFF] ^ shift_table[3][c >> 24];
+      crc0 ^= s == 0 ? crc1 : crc2;
+    }
+    p += 3*STRIDE;
+    length -= 3*STRIDE;
+  }
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc0 = _mm_crc32_u64(crc0, word);
+    p += 8;
+    length -= 8;
+  }
+  crc = (uint32_t)crc0;
+  while (length-- > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+// fills shift_table; advancing over zeroes is linear, so each byte of the crc is done separately
+static void build_shift_table() {
+  unsigned char zeroes[STRIDE];
+  memset(zeroes, 0, sizeof(zeroes));
+  for (int k = 0; k < 4; k++) {
+    for (int v = 0; v < 256; v++) {
+      shift_table[k][v] = crc32c_software((uint32_t)v << (8*k), zeroes, STRIDE);
+    }
+  }
+}
+#endif
+
+unsigned int crc32c(const void *data, size_t length) {
+#if defined(__x86_64__)
+  static int has_sse42 = -1;
+  if (has_sse42 < 0) {
+    has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) build_shift_table();
+  }
+  if (has_sse42) return ~crc32c_sse42(~0U, data, length);
+#endif
+  return ~crc32c_software(~0U, data, length);
+}
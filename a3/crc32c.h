@@ -0,0 +1,11 @@
+// CRC32C (Castagnoli polynomial), used for the per-block checksums of the SFS
+// uses the SSE4.2 crc32 instruction when the cpu has it, and a table-driven fallback otherwise
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+
+// returns the crc32c of length bytes at data
+unsigned int crc32c(const void *data, size_t length);
+
+#endif
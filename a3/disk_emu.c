@@ -6,66 +6,66 @@
 #include "disk_emu.h"
 
 
-FILE* fp = NULL;
+/*Every open disk file; a slot whose fp is NULL is free*/
+static struct disk
+{
+    FILE* fp;
+    int block_size;
+    int num_blocks;
+} disks[MAX_DISKS];
+static int default_disk = -1; /*disk used by the calls that take no disk handle*/
 double L, p;
 double r;
-int BLOCK_SIZE, MAX_BLOCK, MAX_RETRY, lru;
+int MAX_RETRY, lru;
+long disk_blocks_read = 0, disk_blocks_written = 0; /*I/O counters for benchmarks*/
+
+/*----------------------------------------------------------*/
+/*Returns the disk for a handle, or NULL if it is not open   */
+/*----------------------------------------------------------*/
+static struct disk* get_disk(int disk)
+{
+    if (disk < 0 || disk >= MAX_DISKS || NULL == disks[disk].fp)
+    {
+        return NULL;
+    }
+    return &disks[disk];
+}
 
 /*----------------------------------------------------------*/
 /*Close the disk file filled when you don't need it anymore. */
 /*----------------------------------------------------------*/
-int close_disk()
+int disk_close(int disk)
 {
-    if(NULL != fp)
+    struct disk* d = get_disk(disk);
+    if(NULL != d)
     {
-        fclose(fp);
+        fclose(d->fp);
+        d->fp = NULL;
     }
     return 0;
 }
 
-/*---------------------------------------*/
-/*Initializes a disk file filled with 0's*/
-/*---------------------------------------*/
-int init_fresh_disk(char *filename, int block_size, int num_blocks)
+/*----------------------------------------------------------*/
+/*Forces everything written so far out to the disk file      */
+/*----------------------------------------------------------*/
+int disk_sync(int disk)
 {
-    int i, j;
-    
-    /*Set up latency at 0.02 second*/
-    L = 00000.f;
-    /*Set up failure at 10%*/
-    p = -1.f;
-    /*Set up max retry attempts after failure to 3*/
-    MAX_RETRY = 3;
-
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
-    /*Initializes the random number generator*/
-    srand((unsigned int)(time( 0 )) );
-    /*Creates a new file*/
-    fp = fopen (filename, "w+b");
-
-    if (fp == NULL)
+    struct disk* d = get_disk(disk);
+    if(NULL == d || fflush(d->fp) != 0 || fsync(fileno(d->fp)) != 0)
     {
-        printf("Could not create new disk file %s\n\n", filename);
         return -1;
     }
-    
-    /*Fills the file with 0's to its given size*/
-    for (i = 0; i < MAX_BLOCK; i++)
-    {
-        for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            fputc(0, fp);
-        }
-    }
     return 0;
 }
-/*----------------------------*/
-/*Initializes an existing disk*/
-/*----------------------------*/
-int init_disk(char *filename, int block_size, int num_blocks)
+
+/*-------------------------------------------------------------------*/
+/*Opens a disk file, filled with 0's first if fresh is set           */
+/*Returns the handle of the disk, or -1 if it could not be opened    */
+/*-------------------------------------------------------------------*/
+int disk_open(char *filename, int block_size, int num_blocks, int fresh)
 {
+    int i, j, disk;
+
     /*Set up latency at 0.02 second*/
     L = 00000.f;
     /*Set up failure at 10%*/
@@ -73,44 +73,71 @@ int init_disk(char *filename, int block_size, int num_blocks)
     /*Set up max retry attempts after failure to 3*/
     MAX_RETRY = 3;
 
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
     /*Initializes the random number generator*/
     srand((unsigned int)(time( 0 )) );
-    
-    /*Opens a file*/
-    fp = fopen (filename, "r+b");
 
-    if (fp == NULL)
+    for (disk = 0; disk < MAX_DISKS && NULL != disks[disk].fp; disk++);
+    if (disk == MAX_DISKS)
+    {
+        printf("Too many disks open to open %s\n\n", filename);
+        return -1;
+    }
+
+    if (fresh)
+    {
+        /*Creates a new file*/
+        disks[disk].fp = fopen (filename, "w+b");
+    }
+    else
+    {
+        /*Opens a file*/
+        disks[disk].fp = fopen (filename, "r+b");
+    }
+
+    if (disks[disk].fp == NULL)
     {
         printf("Could not open %s\n\n", filename);
         return -1;
     }
-    return 0;
+    disks[disk].block_size = block_size;
+    disks[disk].num_blocks = num_blocks;
+
+    if (fresh)
+    {
+        /*Fills the file with 0's to its given size*/
+        for (i = 0; i < num_blocks; i++)
+        {
+            for (j = 0; j < block_size; j++)
+            {
+                fputc(0, disks[disk].fp);
+            }
+        }
+    }
+    return disk;
 }
 
 /*-------------------------------------------------------------------*/
 /*Reads a series of blocks from the disk into the buffer             */
 /*-------------------------------------------------------------------*/
-int read_blocks(int start_address, int nblocks, void *buffer)
+int disk_read(int disk, int start_address, int nblocks, void *buffer)
 {
-    int i, j, e, s;
+    int i, e, s;
     e = 0;
     s = 0;
-
-    /*Sets up a temporary buffer*/
-    void* blockRead = (void*) malloc(BLOCK_SIZE);
+    struct disk* d = get_disk(disk);
 
     /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+    if (NULL == d || start_address + nblocks > d->num_blocks)
     {
         printf("out of bound error %d\n", start_address);
         return -1;
     }
 
+    /*Sets up a temporary buffer*/
+    void* blockRead = (void*) malloc(d->block_size);
+
     /*Goto the data requested from the disk*/
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
+    fseek(d->fp, start_address * d->block_size, SEEK_SET);
 
     /*For every block requested*/
     for (i = 0; i < nblocks; ++i)
@@ -119,13 +146,11 @@ int read_blocks(int start_address, int nblocks, void *buffer)
         // usleep(L);
 
         s++;
-        fread(blockRead, BLOCK_SIZE, 1, fp);
+        fread(blockRead, d->block_size, 1, d->fp);
 
-       for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            memcpy(buffer+(i*BLOCK_SIZE), blockRead, BLOCK_SIZE);  
-        }
+        memcpy(buffer+(i*d->block_size), blockRead, d->block_size);
     }
+    __sync_fetch_and_add(&disk_blocks_read, s); /*disks may be used from several threads at once*/
 
     free(blockRead);
 
@@ -140,23 +165,24 @@ int read_blocks(int start_address, int nblocks, void *buffer)
 /*------------------------------------------------------------------*/
 /*Writes a series of blocks to the disk from the buffer             */
 /*------------------------------------------------------------------*/
-int write_blocks(int start_address, int nblocks, void *buffer)
+int disk_write(int disk, int start_address, int nblocks, void *buffer)
 {
     int i, e, s;
     e = 0;
     s = 0;
-
-    void* blockWrite = (void*) malloc(BLOCK_SIZE);
+    struct disk* d = get_disk(disk);
 
     /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+    if (NULL == d || start_address + nblocks > d->num_blocks)
     {
         printf("out of bound error\n");
         return -1;
     }
 
+    void* blockWrite = (void*) malloc(d->block_size);
+
     /*Goto where the data is to be written on the disk*/        
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
+    fseek(d->fp, start_address * d->block_size, SEEK_SET);
 
     /*For every block requested*/        
     for (i = 0; i < nblocks; ++i)
@@ -164,13 +190,14 @@ int write_blocks(int start_address, int nblocks, void *buffer)
         /*Pause until the latency duration is elapsed*/
         usleep(L);
 
-        memcpy(blockWrite, buffer+(i*BLOCK_SIZE), BLOCK_SIZE);
+        memcpy(blockWrite, buffer+(i*d->block_size), d->block_size);
 
-        fwrite(blockWrite, BLOCK_SIZE, 1, fp);
-        fflush(fp);
+        fwrite(blockWrite, d->block_size, 1, d->fp);
+        fflush(d->fp);
         s++;
     }
     free(blockWrite);
+    __sync_fetch_and_add(&disk_blocks_written, s);
 
     /*If no failure return the number of blocks written, else return the negative number of failures*/
     if (e == 0)
@@ -178,3 +205,42 @@ int write_blocks(int start_address, int nblocks, void *buffer)
     else
         return e;
 }
+
+/*------------------------------------------------------------------*/
+/*The calls below work on a single default disk, as before handles  */
+/*------------------------------------------------------------------*/
+int init_fresh_disk(char *filename, int block_size, int num_blocks)
+{
+    disk_close(default_disk);
+    default_disk = disk_open(filename, block_size, num_blocks, 1);
+    return default_disk < 0 ? -1 : 0;
+}
+
+int init_disk(char *filename, int block_size, int num_blocks)
+{
+    disk_close(default_disk);
+    default_disk = disk_open(filename, block_size, num_blocks, 0);
+    return default_disk < 0 ? -1 : 0;
+}
+
+int read_blocks(int start_address, int nblocks, void *buffer)
+{
+    return disk_read(default_disk, start_address, nblocks, buffer);
+}
+
+int write_blocks(int start_address, int nblocks, void *buffer)
+{
+    return disk_write(default_disk, start_address, nblocks, buffer);
+}
+
+int close_disk()
+{
+    disk_close(default_disk);
+    default_disk = -1;
+    return 0;
+}
+
+int sync_disk()
+{
+    return disk_sync(default_disk);
+}
@@ -3,3 +3,16 @@ int init_disk(char *filename, int block_size, int num_blocks);
 int read_blocks(int start_address, int nblocks, void *buffer);
 int write_blocks(int start_address, int nblocks, void *buffer);
 int close_disk();
+int sync_disk();
+
+/*The same for any number of disks open at once, each named by the handle disk_open returns*/
+#define MAX_DISKS 16
+int disk_open(char *filename, int block_size, int num_blocks, int fresh);
+int disk_read(int disk, int start_address, int nblocks, void *buffer);
+int disk_write(int disk, int start_address, int nblocks, void *buffer);
+int disk_close(int disk);
+int disk_sync(int disk);
+
+/*Blocks moved by every disk read and write since the program started*/
+extern long disk_blocks_read;
+extern long disk_blocks_written;
@@ -0,0 +1,129 @@
+// LZ4 block format compression; see lz.h
+// a block is a series of sequences: a token (literal count, match length - 4), the literals,
+// then a 2 byte offset back to the match. counts of 15 or more continue in extra bytes.
+// the last sequence has literals only; the last 5 bytes are always literals and the last
+// match starts at least 12 bytes before the end
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MATCH_SAFETY 12
+#define MAX_OFFSET 65535
+
+static uint32_t read32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+// writes a count's continuation bytes after a token nibble of 15
+// returns new output position, or -1 if out of room
+static int write_count(unsigned char *dst, int out, int capacity, int count) {
+  for (; count >= 255; count -= 255) {
+    if (out >= capacity) return -1;
+    dst[out++] = 255;
+  }
+  if (out >= capacity) return -1;
+  dst[out++] = count;
+  return out;
+}
+
+// writes a sequence: literals, then a match of match_length at offset (no match if match_length is 0)
+// returns new output position, or -1 if out of room
+static int write_sequence(unsigned char *dst, int out, int capacity, const unsigned char *literals,
+                          int literal_length, int offset, int match_length) {
+  if (out >= capacity) return -1;
+  int token = out++;
+  int match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+  dst[token] = (literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15);
+  if (literal_length >= 15 && (out = write_count(dst, out, capacity, literal_length - 15)) < 0) return -1;
+  if (out + literal_length > capacity) return -1;
+  memcpy(dst + out, literals, literal_length);
+  out += literal_length;
+  if (match_length == 0) return out;
+  if (out + 2 > capacity) return -1;
+  dst[out++] = offset & 0xFF;
+  dst[out++] = offset >> 8;
+  if (match_code >= 15 && (out = write_count(dst, out, capacity, match_code - 15)) < 0) return -1;
+  return out;
+}
+
+int lz_compress(const unsigned char *src, int length, unsigned char *dst, int capacity) {
+  int table[1 << HASH_BITS]; // last position + 1 of each hashed 4 byte sequence, 0 if none
+  memset(table, 0, sizeof(table));
+  int anchor = 0, pos = 0, out = 0;
+  int misses = 0; // incompressible input is skipped through faster and faster
+  while (pos < length - MATCH_SAFETY) {
+    uint32_t sequence = read32(src + pos);
+    int hash = (sequence*2654435761U) >> (32 - HASH_BITS);
+    int candidate = table[hash] - 1;
+    table[hash] = pos + 1;
+    if (candidate < 0 || pos - candidate > MAX_OFFSET || read32(src + candidate) != sequence) {
+      pos += 1 + (misses++ >> 6);
+      continue;
+    }
+    misses = 0;
+    while (pos > anchor && candidate > 0 && src[pos - 1] == src[candidate - 1]) { // extending backwards
+      pos--;
+      candidate--;
+    }
+    int match_length = MIN_MATCH;
+    while (pos + match_length < length - LAST_LITERALS && src[candidate + match_length] == src[pos + match_length]) {
+      match_length++;
+    }
+    out = write_sequence(dst, out, capacity, src + anchor, pos - anchor, pos - candidate, match_length);
+    if (out < 0) return -1;
+    pos += match_length;
+    anchor = pos;
+  }
+  return write_sequence(dst, out, capacity, src + anchor, length - anchor, 0, 0);
+}
+
+int lz_decompress(const unsigned char *src, int length, unsigned char *dst, int capacity) {
+  int in = 0, out = 0;
+  while (in < length) {
+    int token = src[in++];
+    int literal_length = token >> 4;
+    if (literal_length == 15) {
+      int extra;
+      do {
+        if (in >= length) return -1;
+        extra = src[in++];
+        literal_length += extra;
+      } while (extra == 255);
+    }
+    if (in + literal_length > length || out + literal_length > capacity) return -1;
+    memcpy(dst + out, src + in, literal_length);
+    in += literal_length;
+    out += literal_length;
+    if (in == length) break; // last sequence has no match
+
+    if (in + 2 > length) return -1;
+    int offset = src[in] | src[in + 1] << 8;
+    in += 2;
+    if (offset == 0 || offset > out) return -1;
+    int match_length = token & 15;
+    if (match_length == 15) {
+      int extra;
+      do {
+        if (in >= length) return -1;
+        extra = src[in++];
+        match_length += extra;
+      } while (extra == 255);
+    }
+    match_length += MIN_MATCH;
+    if (out + match_length > capacity) return -1;
+    if (offset >= match_length) {
+      memcpy(dst + out, dst + out - offset, match_length);
+      out += match_length;
+    } else {
+      for (int i = 0; i < match_length; i++, out++) { // match overlaps its own output
+        dst[out] = dst[out - offset];
+      }
+    }
+  }
+  return out;
+}
@@ -0,0 +1,14 @@
+// LZ4 block format compression, used for the compressed extents of the SFS
+// greedy single-probe matcher: fast rather than tight, like the reference lz4 at level 1
+#ifndef LZ_H
+#define LZ_H
+
+// compresses length bytes of src into dst
+// returns compressed length on success, -1 if it does not fit in capacity bytes
+int lz_compress(const unsigned char *src, int length, unsigned char *dst, int capacity);
+
+// decompresses length bytes of src into dst
+// returns decompressed length on success, -1 if src is malformed or does not fit in capacity bytes
+int lz_decompress(const unsigned char *src, int length, unsigned char *dst, int capacity);
+
+#endif
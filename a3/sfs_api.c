@@ -6,43 +6,22 @@
 // I managed to get it working, but also found when I was debugging that things would
 // work better in GCC than clang.
 #include "sfs_api.h"
+#include "sfs_layout.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "disk_emu.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
 
-#define FSNAME "testsys"
-
-int init_fresh_disk(char *filename, int block_size, int num_blocks);
-int init_disk(char *filename, int block_size, int num_blocks);
-int read_blocks(int start_address, int nblocks, void *buffer);
-int write_blocks(int start_address, int nblocks, void *buffer);
 int update_root_directory(int, char*);
 int ssfs_fwrite_no_allocate(int, char*, int);
 int get_empty_block();
-int close_disk();
-
-// useful for assembling reads/writes
-// must be packed in order that padding doesn't cause data to be lost
-struct __attribute__((__packed__)) block {
-  unsigned char bytes[1024];
-} block_t;
-
-// 1 inode per file, 64 bytes each (16 inodes per block)
-// must be packed in order that padding doesn't cause data to be lost
-struct __attribute__((__packed__)) inode {
-  int size;
-  int direct[14];
-  int indirect;
-} inode_t;
-
-// stored at beginning of file system; takes one block
-// must be packed in order that padding doesn't cause data to be lost
-struct __attribute__((__packed__)) superblock {
-  int magic_number;
-  int super_block_size;
-  int super_num_blocks;
-  struct inode jnode;
-} superblock_t;
 
 struct fd {
   struct inode descriptor_inode;
@@ -50,79 +29,580 @@ struct fd {
   int read_ptr;
   int write_ptr;
   int written;
+  int modified; // written to since opened; the file is compressed when closed
 } fd_t;
 
-static struct superblock super;
-static struct block fbm;
-char root_directory[200][16];
-static struct fd file_descriptor_table[32];
-int fd_counter = 0; // counter for file descriptors
+// dentry cache: the inode a name resolved to in a directory, or -1 if the name is known not to
+// be there, so that walking a path costs no directory reads once its components are cached.
+// a slot holds whichever name hashed to it last, and is updated as entries are made or removed
+#define DCACHE_SIZE 512
+struct dentry {
+  int parent; // directory the name is in, 0 for the top level; -1 if the slot is unused
+  int inode_index; // -1 for a negative entry
+  char name[DIR_NAME_LENGTH];
+};
+
+// fingerprint index for deduplication: the crc32c of a data block in use, as kept in the
+// checksum table, to the block. it is built from the checksum table on first use after
+// mounting, so it costs no disk reads. entries go stale when their block is freed or
+// rewritten; stale entries are skipped by lookups and reused by insertions
+#define DEDUP_INDEX_SIZE 2048
+
+// everything kept in memory for one mounted volume: its disk, the metadata read from it and
+// the fds open on it. volumes[0] is the volume mkssfs mounts, and ssfs_mount mounts others
+// in the rest; every api call works on the volume vol points to, which it sets first from
+// the volume handle, fd or mapping it was given. vol is per thread, so threads can work on
+// different volumes at once
+#define MAX_VOLUMES 8
+struct volume {
+  int disk; // disk_emu handle of the image
+  struct superblock super;
+  struct block fbm;
+  char root_directory[256][16]; // 200 entries used, sized to the 4 blocks read into it
+  int fbm_loaded; // fbm and root directory are read on first touch after mounting
+  int root_directory_loaded;
+  struct inode inode_table[(ROOT_DIR_BLOCK - 1)*INODES_PER_BLOCK]; // loaded on first touch like the fbm
+  int inode_table_loaded;
+  int mounted;
+  struct fd file_descriptor_table[32];
+  int fd_counter; // counter for file descriptors
+  int next_file; // root directory index ssfs_getnextfilename looks at next
+  unsigned int checksums[SFS_NUM_BLOCKS]; // crc32c of every block, on volumes with a checksum table
+  int checksums_loaded;
+  int checksums_dirty; // bit i set if checksum block i changed since it was last written
+  // batched metadata calls defer inode and root directory writes to flush_metadata while this is
+  // set, so a block changed for many files is written once
+  int batching;
+  int inode_blocks_dirty; // bit i set if inode block i + 1 changed while batching
+  int root_blocks_dirty; // bit i set if root directory block i changed while batching
+  // decompressed data of the compressed extent read last, so reads walking through an extent
+  // decompress it once; dropped when any block of its stream is written to
+  struct {
+    int blocks[EXTENT_BLOCKS]; // blocks of the compressed stream
+    int num_blocks; // 0 if nothing is cached
+    char data[EXTENT_BLOCKS*SFS_BLOCK_SIZE];
+  } extent_cache;
+  struct {
+    unsigned int fingerprint;
+    int block; // 0 if the entry is empty
+  } dedup_index[DEDUP_INDEX_SIZE];
+  int dedup_index_used; // entries that are not empty, stale ones included
+  int dedup_index_loaded;
+  int fbm_dirty; // reference counts changed since ssfs_fwrite last wrote the fbm
+  struct dentry dcache[DCACHE_SIZE];
+};
+static struct volume volumes[MAX_VOLUMES];
+static __thread struct volume *vol = &volumes[0];
+
+// file ranges mapped into memory by ssfs_mmap. a mapping starts out inaccessible and its
+// pages are read in from the file by mapping_fault as they are first touched; a page
+// written to is made writable and marked dirty, and only dirty pages are written back
+#define PAGE_ABSENT 0 // not read in yet; any access faults
+#define PAGE_CLEAN 1 // read in, read-only; a write faults and makes it dirty
+#define PAGE_DIRTY 2 // writable, written back by ssfs_msync
+static struct mapping {
+  char *addr; // start of the mapping, page aligned; NULL if the slot is unused
+  struct volume *volume; // volume of the mapped file
+  int offset; // file offset of addr
+  int length; // bytes mapped
+  int inode_index; // head inode of the mapped file
+  int num_pages;
+  unsigned char *pages; // PAGE_* state of every page
+} mappings[32];
+static long page_size = 0;
+static struct sigaction previous_segv; // handler to fall back on for faults outside every mapping
+static FILE *trace_file = NULL; // api calls are recorded here if SFS_TRACE names a file
+static int trace_checked = 0;
+
+void read_inode(int inode_index, struct inode *node);
+void write_inode(int inode_index, struct inode *node);
+int read_checked(int start_address, int nblocks, void *buffer);
+int write_checked(int start_address, int nblocks, void *buffer);
+int compressed_slots(struct inode *node, int base);
+int stream_position(struct inode *node, int slot);
+char *load_extent(struct inode *node, int base);
+int inflate_extent(struct inode *node, int base);
+void compress_modified(int inode_index);
+int block_refs(int block);
+int add_block_ref(int block);
+void release_block(int block);
+int deduplicating();
+int find_duplicate(char *data, unsigned int fingerprint);
+void dedup_insert(unsigned int fingerprint, int block);
+void load_dedup_index();
+int sync_mappings(int inode_index, int release);
+int write_at(int inode_index, int pos, char *buf, int length);
+void count_unallocated(int inode_index, int start, int end, int *blocks_needed, int *inodes_needed);
+int check_write_range(int inode_index, int start, int end, int holes_only);
+int inode_write(int inode_index, int pos, char *buf, int length, int holes_only);
+int inode_read(int inode_index, int pos, char *buf, int length);
+int walk_path(char *path, int *parent, char *leaf);
+int is_directory(int inode_index);
+int is_marker(char *name);
+int create_entry(int parent, char *name, int directory);
+void remove_entry(int parent, char *name);
+void dcache_clear();
+void drop_mapped_pages(int inode_index, int start, int end);
+
+// points vol at the volume with handle volume, for an api call on it
+// a handle kept past ssfs_vunmount fails here, so it cannot reach the image mounted in its
+// slot later; mkssfs and ssfs_mount, which mount a slot, point vol at it themselves
+// returns 0 on success, -1 if there is no such volume or it is not mounted
+int use_volume(int volume) {
+  if (volume < 0 || volume >= MAX_VOLUMES || !volumes[volume].mounted) {
+    return -1;
+  }
+  vol = &volumes[volume];
+  return 0;
+}
 
-void mkssfs(int fresh){
+// points vol at the volume of fd *fileID and turns *fileID into its index in that volume's
+// file_descriptor_table; the fds of volume v are v*32 to v*32 + 31, so those of volume 0
+// are the indices themselves. an fd that is out of range keeps failing the checks on it
+// returns 0 on success, -1 if there is no such volume or it is not mounted, so an fd kept
+// past an unmount cannot reach whatever image is mounted in the same slot later
+int use_fd(int *fileID) {
+  if (*fileID < 0) {
+    vol = &volumes[0];
+    return 0;
+  }
+  if (use_volume(*fileID/32) < 0) {
+    return -1;
+  }
+  *fileID %= 32;
+  return 0;
+}
 
-  // upon creation/loading of fs, all fd's must be replaced/reset
-  fd_counter = 0;
+// closes every fd of the volume vol points to, without writing anything back
+void clear_fds() {
+  vol->fd_counter = 0;
   for (int i = 0; i < 32; i++) {
-    file_descriptor_table[i].fd_inode_index = 0;
-    file_descriptor_table[i].read_ptr = 0;
-    file_descriptor_table[i].write_ptr = 0;
-    file_descriptor_table[i].written = 0;
+    vol->file_descriptor_table[i].fd_inode_index = 0;
+    vol->file_descriptor_table[i].read_ptr = 0;
+    vol->file_descriptor_table[i].write_ptr = 0;
+    vol->file_descriptor_table[i].written = 0;
+    vol->file_descriptor_table[i].modified = 0;
+  }
+}
+
+// starts a line in the trace file named by the SFS_TRACE environment variable, if set, with
+// "<time in us> <pid> ", for an api call on the volume vol points to
+// only calls on volume 0 are traced, as sfs_replay replays them on a single volume
+// returns the trace file, or NULL if the call is not traced
+FILE *trace_line() {
+  if (vol != &volumes[0]) return NULL;
+  if (!trace_checked) {
+    trace_checked = 1;
+    char *path = getenv("SFS_TRACE");
+    if (path != NULL) {
+      trace_file = fopen(path, "a");
+      if (trace_file != NULL) setvbuf(trace_file, NULL, _IOLBF, 0); // forked children must not inherit buffered lines
+    }
+  }
+  if (trace_file == NULL) return NULL;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  fprintf(trace_file, "%ld %d ", now.tv_sec*1000000L + now.tv_nsec/1000, (int)getpid());
+  return trace_file;
+}
+
+// appends a line describing an api call to the trace: "<time in us> <pid> <op> <args>", as
+// read by sfs_replay. the file and directory calls are traced; the maintenance calls (defrag,
+// verify, the compression and dedup settings) and the mmap calls are not, as accesses through
+// a mapping are no calls that could be recorded
+void trace_op(const char *format, ...) {
+  FILE *out = trace_line();
+  if (out == NULL) return;
+  va_list args;
+  va_start(args, format);
+  vfprintf(out, format, args);
+  va_end(args);
+  fputc('\n', out);
+}
+
+// traces a batch call on count names as "<op> <count> <name> ...", one line however many
+// names there are
+void trace_names(const char *op, char **names, int count) {
+  FILE *out = trace_line();
+  if (out == NULL) return;
+  fprintf(out, "%s %d", op, count);
+  for (int i = 0; i < count; i++) {
+    fprintf(out, " %s", names[i]);
+  }
+  fputc('\n', out);
+}
+
+// true if the mounted volume keeps a checksum for every block
+int has_checksums() {
+  return vol->super.checksums == SFS_CHECKSUM_MAGIC;
+}
+
+// loads the checksum table on first touch after mounting, like the fbm
+void load_checksums() {
+  if (!vol->checksums_loaded) {
+    disk_read(vol->disk, CHECKSUM_BLOCK, CHECKSUM_BLOCKS, vol->checksums);
+    vol->checksums_loaded = 1;
+  }
+}
+
+// reads blocks like disk_read, then checks every block against its stored checksum
+// a block that fails is reported, and the whole read fails so callers never use bad data
+// returns number of blocks read on success, -1 on failure
+int read_checked(int start_address, int nblocks, void *buffer) {
+  int result = disk_read(vol->disk, start_address, nblocks, buffer);
+  if (result < 0 || !has_checksums()) {
+    return result;
+  }
+  load_checksums();
+  for (int i = 0; i < nblocks; i++) {
+    int block = start_address + i;
+    if (crc32c((char*)buffer + i*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE) != vol->checksums[block]) {
+      fprintf(stderr, "SFS: checksum mismatch in block %d, data is corrupt\n", block);
+      result = -1;
+    }
+  }
+  return result;
+}
+
+// writes blocks like disk_write and updates their checksums in memory
+// the checksum blocks are written back by flush_checksums once the api call is done
+// returns number of blocks written on success, -1 on failure
+int write_checked(int start_address, int nblocks, void *buffer) {
+  int result = disk_write(vol->disk, start_address, nblocks, buffer);
+  for (int i = 0; i < vol->extent_cache.num_blocks; i++) {
+    if (vol->extent_cache.blocks[i] >= start_address && vol->extent_cache.blocks[i] < start_address + nblocks) {
+      vol->extent_cache.num_blocks = 0;
+    }
+  }
+  if (result < 0 || !has_checksums()) {
+    return result;
+  }
+  load_checksums();
+  int per_block = SFS_BLOCK_SIZE/sizeof(vol->checksums[0]);
+  for (int i = 0; i < nblocks; i++) {
+    vol->checksums[start_address + i] = crc32c((char*)buffer + i*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE);
+    vol->checksums_dirty |= 1 << ((start_address + i)/per_block);
+  }
+  return result;
+}
+
+// writes back the checksum blocks changed by the current api call
+void flush_checksums() {
+  int per_block = SFS_BLOCK_SIZE/sizeof(vol->checksums[0]);
+  for (int i = 0; i < CHECKSUM_BLOCKS; i++) {
+    if (vol->checksums_dirty & (1 << i)) {
+      disk_write(vol->disk, CHECKSUM_BLOCK + i, 1, &vol->checksums[i*per_block]);
+    }
+  }
+  vol->checksums_dirty = 0;
+}
+
+// loads the fbm on first touch after mounting; from then on the copy in memory is used
+void load_fbm() {
+  if (!vol->fbm_loaded) {
+    read_checked(FBM_BLOCK, 1, &vol->fbm);
+    vol->fbm_loaded = 1;
+  }
+}
+
+// loads the root directory on first touch after mounting; from then on the copy in memory is used
+void load_root_directory() {
+  if (!vol->root_directory_loaded) {
+    read_checked(ROOT_DIR_BLOCK, 4, &vol->root_directory);
+    vol->root_directory_loaded = 1;
+  }
+}
+
+// walks every directory reachable from the top level (the directories among the root
+// directory's files, and the long names directory), marking in named the nested head inodes
+// their entries name. an entry naming anything else, such as an inode since freed or reused,
+// or one an earlier entry already names, is bad, and is cleared if clear is set
+// returns number of bad entries, or -1 if a directory failed its checksum
+int check_directories(char *named, int clear) {
+  int queue[200];
+  int queued = 0;
+  memset(named, 0, 200);
+  for (int i = 1; i < 200; i++) {
+    char *name = vol->root_directory[i];
+    if (strcmp(name, LONG_NAMES_NAME) == 0 || (name[0] != 0 && !is_marker(name) && is_directory(i))) {
+      queue[queued++] = i;
+    }
+  }
+  int bad = 0;
+  struct dir_entry entries[SFS_BLOCK_SIZE/sizeof(struct dir_entry)];
+  for (int q = 0; q < queued; q++) { // a directory is queued once, when its entry is found
+    struct inode head;
+    read_inode(queue[q], &head);
+    int size = INODE_SIZE(head.size);
+    for (int pos = 0; pos < size; pos += SFS_BLOCK_SIZE) {
+      int length = size - pos < SFS_BLOCK_SIZE ? size - pos : SFS_BLOCK_SIZE;
+      if (inode_read(queue[q], pos, (char*)entries, length) < 0) return -1;
+      for (int i = 0; i < length/(int)sizeof(struct dir_entry); i++) {
+        int inode_index = entries[i].inode;
+        if (inode_index == 0) continue;
+        if (inode_index > 0 && inode_index < 200 && !named[inode_index]
+            && strcmp(vol->root_directory[inode_index], NESTED_INODE_NAME) == 0) {
+          named[inode_index] = 1;
+          if (is_directory(inode_index)) queue[queued++] = inode_index;
+          continue;
+        }
+        bad++;
+        if (clear) {
+          memset(&entries[i], 0, sizeof(entries[i]));
+          write_at(queue[q], pos + i*sizeof(struct dir_entry), (char*)&entries[i], sizeof(entries[i]));
+        }
+      }
+    }
+  }
+  return bad;
+}
+
+// consistency scan, run when mounting a volume that was not cleanly unmounted
+// rebuilds the fbm from the blocks actually referenced by the inode chains of every file,
+// counting the pointers to each shared block, and releases (anonIN) inodes that no file's chain
+// reaches any more. a nested file counts only if a directory entry names it, and is released
+// with its chain otherwise; entries naming no nested file are cleared once the fbm is rebuilt.
+// if a directory cannot be read, every nested file is kept and no entry is touched
+void check_volume() {
+  char reached[200];
+  memset(reached, 0, sizeof(reached));
+  load_root_directory();
+  char named[200];
+  int directories_read = check_directories(named, 0) >= 0;
+  for (int i = FIRST_DATA_BLOCK; i < FBM_BLOCK; i++) {
+    vol->fbm.bytes[i] = !(has_checksums() && i >= CHECKSUM_BLOCK);
+  }
+  vol->fbm_loaded = 1;
+
+  struct inode node;
+  for (int i = 1; i < 200; i++) {
+    if (vol->root_directory[i][0] == 0 || strcmp(vol->root_directory[i], ANON_INODE_NAME) == 0) continue;
+    if (directories_read && !named[i] && strcmp(vol->root_directory[i], NESTED_INODE_NAME) == 0) continue;
+    int inode_index = i;
+    while (inode_index > 0 && inode_index < 200 && !reached[inode_index]) {
+      reached[inode_index] = 1;
+      read_inode(inode_index, &node);
+      for (int j = 0; j < DIRECT_POINTERS; j++) {
+        int pointer = POINTER_BLOCK(node.direct[j]);
+        if (pointer >= FIRST_DATA_BLOCK && pointer < FBM_BLOCK) {
+          add_block_ref(pointer);
+        }
+      }
+      inode_index = node.indirect;
+    }
   }
-  if (fresh == 1) { // if new file system requested
+
+  int orphans = 0;
+  struct inode empty_inode;
+  memset(&empty_inode, 0, sizeof(empty_inode));
+  for (int i = 1; i < 200; i++) {
+    if (!reached[i] && (strcmp(vol->root_directory[i], ANON_INODE_NAME) == 0 || strcmp(vol->root_directory[i], NESTED_INODE_NAME) == 0)) {
+      write_inode(i, &empty_inode);
+      vol->root_directory[i][0] = '\0';
+      orphans++;
+    }
+  }
+  if (orphans > 0) {
+    write_checked(ROOT_DIR_BLOCK, 4, &vol->root_directory);
+  }
+  write_checked(FBM_BLOCK, 1, &vol->fbm);
+  vol->fbm_dirty = 0;
+  if (directories_read) {
+    check_directories(named, 1);
+  }
+}
+
+// marks the volume as cleanly unmounted and closes its disk
+// the next mount can then skip the consistency scan
+// returns 0 on success, -1 if nothing is mounted there
+int ssfs_vunmount(int volume) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_op("unmount");
+  sync_mappings(-1, 1); // unmaps every mapping of the volume
+  compress_modified(-1);
+  clear_fds();
+  vol->super.clean = 1;
+  write_checked(0, 1, &vol->super);
+  flush_checksums();
+  disk_close(vol->disk);
+  vol->mounted = 0;
+  vol->fbm_loaded = 0; // nothing cached here may be written into the next image in this slot
+  vol->root_directory_loaded = 0;
+  vol->inode_table_loaded = 0;
+  vol->checksums_loaded = 0;
+  vol->dedup_index_loaded = 0;
+  return 0;
+}
+
+int ssfs_unmount() {
+  return ssfs_vunmount(0);
+}
+
+// makes every write so far durable; writes already go straight to the disk file,
+// so this only has to push them past the OS cache
+// returns 0 on success, -1 on failure
+int ssfs_vcommit(int volume) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_op("commit");
+  sync_mappings(-1, 0);
+  compress_modified(-1);
+  flush_checksums();
+  return disk_sync(vol->disk);
+}
+
+int ssfs_commit() {
+  return ssfs_vcommit(0);
+}
+
+// mounts the image at path as the volume vol points to, formatting it first if fresh is set
+// mounting only reads the super block: the fbm and root directory are loaded lazily when
+// first needed, so mount time does not depend on the size of the volume. the super block
+// is marked as not clean while mounted, and a volume found not clean gets a consistency scan
+// returns 0 on success, -1 if the image cannot be opened or holds no SFS volume
+int mount_volume(char *path, int fresh) {
+
+  // upon creation/loading of fs, all fd's must be replaced/reset
+  clear_fds();
+  vol->extent_cache.num_blocks = 0; // names blocks of whatever image was mounted here before
+  if (fresh) { // if new file system requested
 
     // initializing super block- also stored in memory
-    init_fresh_disk(FSNAME, 1024, 1024);
-    super.magic_number = 0xACBD0005;
-    super.super_block_size = 1024;
-    super.super_num_blocks = 1024;
+    vol->disk = disk_open(path, 1024, 1024, 1);
+    if (vol->disk < 0) {
+      return -1;
+    }
+    vol->super.magic_number = SFS_MAGIC;
+    vol->super.super_block_size = 1024;
+    vol->super.super_num_blocks = 1024;
     struct inode new_fs_jnode;
     new_fs_jnode.size = 12800;
     for (int i = 0; i < 14; i++) {
       new_fs_jnode.direct[i] = i + 1;
     }
     new_fs_jnode.indirect = 0;
-    super.jnode = new_fs_jnode;
-    write_blocks(0, 1, &super);
+    vol->super.jnode = new_fs_jnode;
+    vol->super.clean = 0;
+    vol->super.compression = 0;
+    vol->super.dedup = 0;
+    memset(vol->super.reserved, 0, sizeof(vol->super.reserved));
+
+    // every block starts out zeroed, so every checksum starts out as that of a zeroed block
+    struct block zero_block;
+    memset(&zero_block, 0, sizeof(zero_block));
+    unsigned int zero_checksum = crc32c(&zero_block, SFS_BLOCK_SIZE);
+    for (int i = 0; i < SFS_NUM_BLOCKS; i++) {
+      vol->checksums[i] = zero_checksum;
+    }
+    vol->checksums_loaded = 1;
+    vol->checksums_dirty = (1 << CHECKSUM_BLOCKS) - 1;
+    vol->super.checksums = SFS_CHECKSUM_MAGIC;
+    write_checked(0, 1, &vol->super);
 
     // initialize and store first inode
     struct inode root_dir_inode;
+    memset(&root_dir_inode, 0, sizeof(root_dir_inode));
     root_dir_inode.size = 3200;
     for (int i = 0; i < 4; i++) { // stores pointers to root dir
       root_dir_inode.direct[i] = i+14;
     }
     root_dir_inode.indirect = 0;
-    write_blocks(1, 1, &root_dir_inode);
+    memset(vol->inode_table, 0, sizeof(vol->inode_table));
+    vol->inode_table_loaded = 1;
+    write_inode(0, &root_dir_inode);
 
     //storing root directory in 0
+    memset(vol->root_directory, 0, sizeof(vol->root_directory));
+    vol->root_directory_loaded = 1;
     update_root_directory(0, "root");
 
     // initializing FBM
     // 0th block is super, 1st-13th are inodes, 14-17th are root dir, 1023rd is fbm
-    // these blocks are marked as used to reserve them
-    for (int i = 18; i < 1023; i++) {
-      fbm.bytes[i] = 1;
+    // these blocks, and the checksum table in 1019th-1022nd, are marked as used to reserve them
+    memset(&vol->fbm, 0, sizeof(vol->fbm));
+    for (int i = 18; i < CHECKSUM_BLOCK; i++) {
+      vol->fbm.bytes[i] = 1;
     }
-    write_blocks(1023, 1, &fbm);
+    vol->fbm_loaded = 1;
+    vol->dedup_index_loaded = 0;
+    write_checked(1023, 1, &vol->fbm);
 
   } else { // if old file system used
 
-    init_disk(FSNAME, 1024, 1024);
-    read_blocks(0, 1, &super); // initialize super block; store in memory
-    if (super.magic_number != 0xACBD0005) {
+    vol->disk = disk_open(path, 1024, 1024, 0);
+    if (vol->disk < 0) {
+      return -1;
+    }
+    disk_read(vol->disk, 0, 1, &vol->super); // initialize super block; store in memory
+    if (vol->super.magic_number != SFS_MAGIC) {
       printf("Magic Number incorrect- wrong file system\n");
+      disk_close(vol->disk);
+      return -1;
+    }
+    vol->fbm_loaded = 0;
+    vol->root_directory_loaded = 0;
+    vol->inode_table_loaded = 0;
+    vol->checksums_loaded = 0;
+    vol->dedup_index_loaded = 0;
+    if (has_checksums()) { // the super block could only be checked once read
+      load_checksums();
+      if (crc32c(&vol->super, SFS_BLOCK_SIZE) != vol->checksums[0]) {
+        fprintf(stderr, "SFS: checksum mismatch in block 0, super block is corrupt\n");
+      }
+    }
+    if (vol->super.clean != 1) { // crashed or never unmounted
+      check_volume();
     }
-    read_blocks(1023, 1, &fbm); // store fbm in mem
-    read_blocks(14, 4, &root_directory); // store root directory in mem
+    vol->super.clean = 0;
+    write_checked(0, 1, &vol->super);
 
   }
+  flush_checksums();
+  vol->fbm_dirty = 0;
+  vol->next_file = 1;
+  dcache_clear();
+  vol->mounted = 1;
+  return 0;
+}
+
+// mounts the volume "testsys" in the current directory as volume 0, the one the calls that
+// take no volume handle work on; a new one is formatted there if fresh is 1
+void mkssfs(int fresh){
+  vol = &volumes[0];
+  trace_op("mkfs %d", fresh);
+  if (vol->mounted) { // remounting in the same process hands the volume over cleanly
+    ssfs_vunmount(0);
+  }
+  mount_volume(FSNAME, fresh == 1);
+}
+
+// mounts the image at path as a volume of its own, formatting it first if opts has
+// SSFS_MOUNT_FRESH, so several images can be mounted at once
+// returns the volume handle to pass to the ssfs_v* calls on success, -1 on failure
+int ssfs_mount(char *path, int opts) {
+  for (int i = 1; i < MAX_VOLUMES; i++) {
+    if (!volumes[i].mounted) {
+      vol = &volumes[i];
+      return mount_volume(path, opts & SSFS_MOUNT_FRESH) < 0 ? -1 : i;
+    }
+  }
+  return -1;
+}
+
+// true if a root directory name marks an inode that is not a top-level file
+int is_marker(char *name) {
+  return strcmp(name, ANON_INODE_NAME) == 0 || strcmp(name, NESTED_INODE_NAME) == 0 || strcmp(name, LONG_NAMES_NAME) == 0;
 }
 
-// compares root directory index with file names
+// compares root directory index with top-level file names
 // returns inode index on success or -1 on failure
 int get_inode_from_name(char* name) {
-  read_blocks(14, 4, &root_directory);
-  for (int i = 0; i < 200; i++) {
-    if (root_directory[i] != NULL && strcmp(name, root_directory[i]) == 0) {
+  load_root_directory();
+  for (int i = 1; i < 200; i++) {
+    if (strcmp(name, vol->root_directory[i]) == 0 && !is_marker(vol->root_directory[i])) {
       return i;
     }
   }
@@ -132,9 +612,9 @@ int get_inode_from_name(char* name) {
 // gets index of the first inode that can be replaced
 // returns -1 on failure
 int get_null_inode() {
-  read_blocks(14, 4, &root_directory);
+  load_root_directory();
   for (int i = 0; i < 200; i++) {
-    if (root_directory[i][0] == 0) {
+    if (vol->root_directory[i][0] == 0) {
       return i;
     }
   }
@@ -145,11 +625,11 @@ int get_null_inode() {
 // returns -1 on failure
 int get_empty_fd() {
   for (int i = 0; i < 32; i++) {
-    if (file_descriptor_table[i].written == 0) {
-      file_descriptor_table[i].fd_inode_index = 0;
-      file_descriptor_table[i].read_ptr = 0;
-      file_descriptor_table[i].write_ptr = 0;
-      fd_counter++;
+    if (vol->file_descriptor_table[i].written == 0) {
+      vol->file_descriptor_table[i].fd_inode_index = 0;
+      vol->file_descriptor_table[i].read_ptr = 0;
+      vol->file_descriptor_table[i].write_ptr = 0;
+      vol->fd_counter++;
       return i;
     }
   }
@@ -157,93 +637,409 @@ int get_empty_fd() {
 }
 
 // updates root directory given name/inode index and name
+// only the block holding the entry is written back, once the batch is over when batching
 // returns -1 on failure, 0 on success
 int update_root_directory(int file_index, char *name) {
-  read_blocks(14, 4, &root_directory);
-  if (read_blocks(14, 4, &root_directory) < 0) {
+  load_root_directory();
+  if (strncpy(vol->root_directory[file_index], name, 16) < 0) { // if copy fails
     return -1;
   }
-  if (strncpy(root_directory[file_index], name, 16) < 0) { // if copy fails
-    return -1;
+  int entries_per_block = SFS_BLOCK_SIZE/16;
+  if (vol->batching) {
+    vol->root_blocks_dirty |= 1 << (file_index/entries_per_block);
+    return 0;
   }
-  if (write_blocks(14, 4, &root_directory) < 0) {
+  if (write_checked(ROOT_DIR_BLOCK + file_index/entries_per_block, 1, vol->root_directory[file_index - file_index%entries_per_block]) < 0) {
     return -1;
   }
   return 0;
 }
 
-// gets index of empty block to write to, zeroes the block, and marks as occupied in fbm
+// gets index of empty block to write to and marks it as occupied in fbm
+// the fbm is only changed in memory; callers write it back once per operation
+// the block is not zeroed- callers always write the whole block before it is read
 // returns -1 on failure
 int get_empty_block() {
-  int fresh_block_index = -1;
-  for (int i = 18; i < 1023; i++) { // determine first free block
-    if (fbm.bytes[i] == 1) {
-      fresh_block_index = i;
-      fbm.bytes[i] = 0;
-      write_blocks(i, 1, &fbm);
-      break;
+  load_fbm();
+  for (int i = FIRST_DATA_BLOCK; i < FBM_BLOCK; i++) { // determine first free block
+    if (vol->fbm.bytes[i] == 1) {
+      vol->fbm.bytes[i] = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// returns number of pointers to a data block according to the fbm, 0 if the block is free
+int block_refs(int block) {
+  load_fbm();
+  if (vol->fbm.bytes[block] == 1) return 0;
+  return vol->fbm.bytes[block] == 0 ? 1 : vol->fbm.bytes[block];
+}
+
+// counts one more pointer to a data block in the fbm; a free block becomes in use
+// like get_empty_block, the fbm is only changed in memory
+// returns 0 on success, -1 if the block already has as many pointers as the fbm can count
+int add_block_ref(int block) {
+  int refs = block_refs(block);
+  if (refs == MAX_BLOCK_REFS) {
+    return -1;
+  }
+  vol->fbm.bytes[block] = refs == 0 ? 0 : refs + 1;
+  vol->fbm_dirty = 1;
+  return 0;
+}
+
+// drops one pointer to a data block in the fbm, freeing the block with its last pointer
+// like get_empty_block, the fbm is only changed in memory
+void release_block(int block) {
+  int refs = block_refs(block);
+  vol->fbm.bytes[block] = refs <= 1 ? 1 : (refs == 2 ? 0 : refs - 1);
+  vol->fbm_dirty = 1;
+}
+
+// counts blocks still marked as free in the fbm
+int count_free_blocks() {
+  load_fbm();
+  int free_blocks = 0;
+  for (int i = FIRST_DATA_BLOCK; i < FBM_BLOCK; i++) {
+    if (vol->fbm.bytes[i] == 1) free_blocks++;
+  }
+  return free_blocks;
+}
+
+// counts inodes not yet claimed by a file or an inode chain
+int count_null_inodes() {
+  int null_inodes = 0;
+  load_root_directory();
+  for (int i = 0; i < 200; i++) {
+    if (vol->root_directory[i][0] == 0) null_inodes++;
+  }
+  return null_inodes;
+}
+
+// loads the inode table on first touch after mounting; from then on the copy in memory is
+// used, so inode blocks are read (and checked against their checksums) once per mount
+void load_inode_table() {
+  if (!vol->inode_table_loaded) {
+    read_checked(1, ROOT_DIR_BLOCK - 1, vol->inode_table);
+    vol->inode_table_loaded = 1;
+  }
+}
+
+// reads inode at inode_index from the inode table into node
+void read_inode(int inode_index, struct inode *node) {
+  load_inode_table();
+  *node = vol->inode_table[inode_index];
+}
+
+// writes node into the inode table at inode_index, and through to its block on disk
+// (when batching, the block is only marked to be written by flush_metadata)
+void write_inode(int inode_index, struct inode *node) {
+  load_inode_table();
+  vol->inode_table[inode_index] = *node;
+  if (vol->batching) {
+    vol->inode_blocks_dirty |= 1 << (inode_index/INODES_PER_BLOCK);
+    return;
+  }
+  write_checked(inode_index/INODES_PER_BLOCK + 1, 1, &vol->inode_table[inode_index - inode_index%INODES_PER_BLOCK]);
+}
+
+// empties the dentry cache; names are looked up afresh after mounting
+void dcache_clear() {
+  for (int i = 0; i < DCACHE_SIZE; i++) {
+    vol->dcache[i].parent = -1;
+  }
+}
+
+// returns the dentry cache slot for name in the directory starting at parent
+struct dentry *dcache_slot(int parent, char *name) {
+  unsigned int hash = 2166136261u ^ parent; // fnv-1a
+  for (char *c = name; *c; c++) {
+    hash = (hash ^ (unsigned char)*c)*16777619u;
+  }
+  return &vol->dcache[hash%DCACHE_SIZE];
+}
+
+// records that name in the directory starting at parent resolves to inode_index (-1: absent)
+void dcache_set(int parent, char *name, int inode_index) {
+  struct dentry *entry = dcache_slot(parent, name);
+  entry->parent = parent;
+  entry->inode_index = inode_index;
+  strncpy(entry->name, name, DIR_NAME_LENGTH - 1);
+  entry->name[DIR_NAME_LENGTH - 1] = '\0';
+}
+
+// true if the file starting at inode_index is a directory
+int is_directory(int inode_index) {
+  struct inode head;
+  read_inode(inode_index, &head);
+  return (head.size & SIZE_DIRECTORY) != 0;
+}
+
+// writes length bytes of buf into the file starting at inode_index from byte position pos,
+// growing it if the write ends past its end. like ssfs_fwrite, the write is all-or-nothing
+// and the fbm is written once
+// returns 0 on success, -1 on failure
+int write_at(int inode_index, int pos, char *buf, int length) {
+  int blocks_needed, inodes_needed;
+  count_unallocated(inode_index, pos, pos + length, &blocks_needed, &inodes_needed);
+  if (blocks_needed > count_free_blocks() || inodes_needed > count_null_inodes()) {
+    return -1;
+  }
+  if (inode_write(inode_index, pos, buf, length, 0) < 0) { // nothing was changed
+    return -1;
+  }
+  if (blocks_needed > 0 || vol->fbm_dirty) {
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+    vol->fbm_dirty = 0;
+  }
+  struct inode head;
+  read_inode(inode_index, &head);
+  if (pos + length > INODE_SIZE(head.size)) {
+    head.size = (head.size & SIZE_DIRECTORY) | (pos + length);
+    write_inode(inode_index, &head);
+  }
+  return 0;
+}
+
+// looks for the entry called name in the directory starting at dir_inode, or for a free entry
+// if name is NULL. the directory is read a block at a time, stopping at the entry
+// returns the entry's byte position in the directory, or -1 if there is none
+// *inode_index, if not NULL, gets the inode the entry names
+int dir_find(int dir_inode, char *name, int *inode_index) {
+  struct dir_entry entries[SFS_BLOCK_SIZE/sizeof(struct dir_entry)];
+  struct inode head;
+  read_inode(dir_inode, &head);
+  int size = INODE_SIZE(head.size);
+  for (int pos = 0; pos < size; pos += SFS_BLOCK_SIZE) {
+    int length = size - pos < SFS_BLOCK_SIZE ? size - pos : SFS_BLOCK_SIZE;
+    if (inode_read(dir_inode, pos, (char*)entries, length) < 0) return -1;
+    for (int i = 0; i < length/(int)sizeof(struct dir_entry); i++) {
+      if (name == NULL ? entries[i].inode == 0
+                       : entries[i].inode != 0 && strncmp(entries[i].name, name, DIR_NAME_LENGTH) == 0) {
+        if (inode_index != NULL) *inode_index = entries[i].inode;
+        return pos + i*sizeof(struct dir_entry);
+      }
+    }
+  }
+  return -1;
+}
+
+// true if the directory starting at dir_inode has no entries in use
+int dir_is_empty(int dir_inode) {
+  struct dir_entry entries[SFS_BLOCK_SIZE/sizeof(struct dir_entry)];
+  struct inode head;
+  read_inode(dir_inode, &head);
+  int size = INODE_SIZE(head.size);
+  for (int pos = 0; pos < size; pos += SFS_BLOCK_SIZE) {
+    int length = size - pos < SFS_BLOCK_SIZE ? size - pos : SFS_BLOCK_SIZE;
+    if (inode_read(dir_inode, pos, (char*)entries, length) < 0) return 0;
+    for (int i = 0; i < length/(int)sizeof(struct dir_entry); i++) {
+      if (entries[i].inode != 0) return 0;
+    }
+  }
+  return 1;
+}
+
+// adds an entry naming inode_index to the directory starting at dir_inode, reusing a free
+// entry if there is one
+// returns 0 on success, -1 on failure
+int dir_add(int dir_inode, char *name, int inode_index) {
+  struct dir_entry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.inode = inode_index;
+  strncpy(entry.name, name, DIR_NAME_LENGTH - 1);
+  int position = dir_find(dir_inode, NULL, NULL);
+  if (position < 0) {
+    struct inode head;
+    read_inode(dir_inode, &head);
+    position = INODE_SIZE(head.size);
+  }
+  return write_at(dir_inode, position, (char*)&entry, sizeof(entry));
+}
+
+// finds the directory holding the top-level names too long for the root directory, making it
+// first if create is set
+// returns its head inode index, or -1 if there is none
+int long_names_directory(int create) {
+  load_root_directory();
+  for (int i = 1; i < 200; i++) {
+    if (strcmp(vol->root_directory[i], LONG_NAMES_NAME) == 0) return i;
+  }
+  if (!create) return -1;
+  int inode_index = get_null_inode();
+  if (inode_index < 0) return -1;
+  struct inode directory;
+  memset(&directory, 0, sizeof(directory));
+  directory.size = SIZE_DIRECTORY;
+  write_inode(inode_index, &directory);
+  update_root_directory(inode_index, LONG_NAMES_NAME);
+  return inode_index;
+}
+
+// looks name up in the directory starting at parent (0 for the top level), through the
+// dentry cache; what a lookup finds, even that the name is absent, goes into the cache
+// returns the inode index the name resolves to, -1 if there is none
+int lookup_name(int parent, char *name) {
+  struct dentry *cached = dcache_slot(parent, name);
+  if (cached->parent == parent && strcmp(cached->name, name) == 0) {
+    return cached->inode_index;
+  }
+  int inode_index = -1;
+  if (parent == 0 && strlen(name) < 16) {
+    inode_index = get_inode_from_name(name);
+  } else {
+    int directory = parent > 0 ? parent : long_names_directory(0);
+    if (directory > 0 && dir_find(directory, name, &inode_index) < 0) inode_index = -1;
+  }
+  dcache_set(parent, name, inode_index);
+  return inode_index;
+}
+
+// walks path ("/a/b/c", "a/b/c" or a plain name): every component but the last must be a
+// directory. leaf gets the last component, and *parent the directory that holds it, 0 for
+// the top level. components are looked up through the dentry cache, so a warm path costs
+// no directory reads
+// returns the leaf's inode index, -1 if the leaf does not exist, -2 if the path is invalid
+// or a directory on the way does not exist
+int walk_path(char *path, int *parent, char *leaf) {
+  *parent = 0;
+  while (*path == '/') path++;
+  while (1) {
+    char *slash = strchr(path, '/');
+    int length = slash != NULL ? slash - path : (int)strlen(path);
+    if (length == 0 || length >= DIR_NAME_LENGTH) return -2;
+    memcpy(leaf, path, length);
+    leaf[length] = '\0';
+    if (is_marker(leaf)) return -2;
+    int inode_index = lookup_name(*parent, leaf);
+    if (slash != NULL) { // a trailing slash ends the path too
+      while (*slash == '/') slash++;
+      if (*slash == '\0') slash = NULL;
     }
+    if (slash == NULL) return inode_index;
+    if (inode_index < 0 || !is_directory(inode_index)) return -2;
+    *parent = inode_index;
+    path = slash;
+  }
+}
+
+// returns the head inode index of the file or directory at path, -1 if there is none
+int find_path(char *path) {
+  int parent;
+  char leaf[DIR_NAME_LENGTH];
+  int inode_index = walk_path(path, &parent, leaf);
+  return inode_index < 0 ? -1 : inode_index;
+}
+
+// makes an empty file, or directory if directory is set, called name in the directory
+// starting at parent (0 for the top level). short top-level names go straight into the root
+// directory; any other name gets an entry in its directory
+// returns the new head inode index on success, -1 on failure
+int create_entry(int parent, char *name, int directory) {
+  int inode_index = get_null_inode();
+  if (inode_index < 0) {
+    return -1;
+  }
+  int in_root = parent == 0 && strlen(name) < 16;
+  if (update_root_directory(inode_index, in_root ? name : NESTED_INODE_NAME) < 0) {
+    return -1;
   }
-  if (fresh_block_index != -1) { // zeroing new block
-    struct block fresh_block;
-    for (int i = 0; i < 1024; i++) {
-      fresh_block.bytes[i] = 0;
+  struct inode new_inode;
+  memset(&new_inode, 0, sizeof(new_inode)); // old data fields require zeroing in case of reuse
+  new_inode.size = directory ? SIZE_DIRECTORY : 0;
+  write_inode(inode_index, &new_inode);
+  if (!in_root) {
+    int holder = parent > 0 ? parent : long_names_directory(1);
+    if (holder < 0 || dir_add(holder, name, inode_index) < 0) {
+      update_root_directory(inode_index, "");
+      return -1;
     }
-    write_blocks(fresh_block_index, 1, &fresh_block);
   }
-  return fresh_block_index;
+  dcache_set(parent, name, inode_index);
+  return inode_index;
+}
+
+// drops the entry called name from the directory starting at parent (0 for the top level)
+// short top-level names need nothing here, as they go with the root directory entry of the
+// file's head inode when its chain is freed
+void remove_entry(int parent, char *name) {
+  dcache_set(parent, name, -1);
+  if (parent == 0 && strlen(name) < 16) return;
+  int holder = parent > 0 ? parent : long_names_directory(0);
+  int position = holder > 0 ? dir_find(holder, name, NULL) : -1;
+  if (position < 0) return;
+  struct dir_entry entry;
+  memset(&entry, 0, sizeof(entry));
+  write_at(holder, position, (char*)&entry, sizeof(entry));
+}
+
+// makes an empty directory at path; every directory on the way must already exist
+// returns 0 on success, -1 if the path is invalid or taken, or there is no space
+int ssfs_vmkdir(int volume, char *path) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_op("mkdir %s", path);
+  int parent;
+  char leaf[DIR_NAME_LENGTH];
+  if (walk_path(path, &parent, leaf) != -1) {
+    return -1;
+  }
+  int result = create_entry(parent, leaf, 1) < 0 ? -1 : 0;
+  flush_checksums();
+  return result;
+}
+
+int ssfs_mkdir(char *path) {
+  return ssfs_vmkdir(0, path);
 }
 
 // opens new fd in file_descriptor_table
+// name is a plain name or a path through directories made by ssfs_mkdir, such as "/a/b/c";
+// a file that does not exist is created, but the directories on its path are not
 // returns fd index on success, -1 on failure
-int ssfs_fopen(char *name){
-  int inode_index = get_inode_from_name(name); // gets index of inode associated with name through root dir
+int ssfs_vfopen(int volume, char *name) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  int parent;
+  char leaf[DIR_NAME_LENGTH];
+  int inode_index = walk_path(name, &parent, leaf); // head inode of the file, through its directories
+  if (inode_index == -2 || (inode_index > 0 && is_directory(inode_index))) {
+    return -1;
+  }
   int fd_index = get_empty_fd();
   if (fd_index < 0) {
-    printf("No space for additional file descriptors- there are %i fds open\n", fd_counter);
+    printf("No space for additional file descriptors- there are %i fds open\n", vol->fd_counter);
     return -1;
   }
 
   if (inode_index < 0) { // if name is not matched, new file is needed
-    inode_index = get_null_inode(); // gets first inode for file
+    inode_index = create_entry(parent, leaf, 0);
     if (inode_index < 0) {
       printf("No space for additional inodes\n");
       return -1;
     }
-
-    // insert name into root directory
-    if (update_root_directory(inode_index, name) < 0) {
-      printf("Updating root directory failed\n");
-      return -1;
-    }
-
     struct inode new_file_inode;
-    new_file_inode.size = 0;
-    for (int i = 0; i < 14; i++) { // old data fields require zeroing in case of reuse
-      new_file_inode.direct[i] = 0;
-    }
-    new_file_inode.indirect = 0;
-
-    // store new inode
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    old_inode_block[inode_index%16] = new_file_inode;
-    write_blocks(inode_index/16 + 1, 1, &old_inode_block);
+    read_inode(inode_index, &new_file_inode);
 
     // make new fd in append mode
-    file_descriptor_table[fd_index].descriptor_inode = new_file_inode;
-    file_descriptor_table[fd_index].fd_inode_index = inode_index;
-    file_descriptor_table[fd_index].read_ptr = 0;
-    file_descriptor_table[fd_index].write_ptr = 0;
-    file_descriptor_table[fd_index].written = 1;
-    return fd_index;
+    vol->file_descriptor_table[fd_index].descriptor_inode = new_file_inode;
+    vol->file_descriptor_table[fd_index].fd_inode_index = inode_index;
+    vol->file_descriptor_table[fd_index].read_ptr = 0;
+    vol->file_descriptor_table[fd_index].write_ptr = 0;
+    vol->file_descriptor_table[fd_index].written = 1;
+    vol->file_descriptor_table[fd_index].modified = 0;
+    flush_checksums();
+    trace_op("open %s %d", name, fd_index);
+    return volume*32 + fd_index;
   } else { // make new fd in append mode
 
     // get file's inode
     struct inode new_file_inode;
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    new_file_inode = old_inode_block[inode_index%16];
+    read_inode(inode_index, &new_file_inode);
 
     // initialize fd, store in mem
     struct fd new_file_fd;
@@ -252,17 +1048,23 @@ int ssfs_fopen(char *name){
     new_file_fd.read_ptr = 0;
     new_file_fd.write_ptr = new_file_inode.size;
     new_file_fd.written = 1;
-    file_descriptor_table[fd_index] = new_file_fd;
+    new_file_fd.modified = 0;
+    vol->file_descriptor_table[fd_index] = new_file_fd;
 
-    return fd_index;
+    trace_op("open %s %d", name, fd_index);
+    return volume*32 + fd_index;
   }
 }
 
+int ssfs_fopen(char *name) {
+  return ssfs_vfopen(0, name);
+}
+
 // closes fd in file_descriptor_table, invalid-pointer-safe
 // returns 0 on success, -1 on failure
 int ssfs_fclose_index(int fileID) {
-    if (file_descriptor_table[fileID].written == 1) {
-      file_descriptor_table[fileID].written = 0;
+    if (vol->file_descriptor_table[fileID].written == 1) {
+      vol->file_descriptor_table[fileID].written = 0;
     } else {
       return -1;
     }
@@ -272,19 +1074,28 @@ int ssfs_fclose_index(int fileID) {
 // closes ALL references to file, despite different indices in fdt
 // returns 0 on success, -1 on failure
 int ssfs_fclose(int fileID) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("close %d", fileID);
   if (fileID < 0 || fileID > 31) { // invalid fileID
     return -1;
   }
-  int inode_index = file_descriptor_table[fileID].fd_inode_index;
+  int inode_index = vol->file_descriptor_table[fileID].fd_inode_index;
   int returner = -1; // value to return- if not updated, will return -1
+  if (vol->file_descriptor_table[fileID].written == 1) {
+    sync_mappings(inode_index, 1); // mappings of the file last as long as it is open
+  }
+  compress_modified(inode_index);
   for (int i = 0; i < 32; i++) {
-    if (file_descriptor_table[i].fd_inode_index == inode_index) { // if fdt[i] points to the same file as fdt[fileID]
+    if (vol->file_descriptor_table[i].fd_inode_index == inode_index) { // if fdt[i] points to the same file as fdt[fileID]
       if (ssfs_fclose_index(i) != -1) { // if able to close a file
         returner = 0;
-        fd_counter--;
+        vol->fd_counter--;
       }
     }
   }
+  flush_checksums();
   return returner;
 }
 
@@ -292,21 +1103,23 @@ int ssfs_fclose(int fileID) {
 // if new location is beyond file size, moves to end of file
 // returns 0 on success, -1 on failure
 int ssfs_frseek(int fileID, int loc) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("rseek %d %d", fileID, loc);
 
-  struct inode inode_block_to_read_from[16]; // making sure inode is current
-  read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block_to_read_from);
-  file_descriptor_table[fileID].descriptor_inode = inode_block_to_read_from[file_descriptor_table[fileID].fd_inode_index%16];
-
-    if (loc < 0 || fileID < 0 || fileID > 31 || file_descriptor_table[fileID].written == 0) {
+    if (loc < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
       // invalid seek
       return -1;
     }
 
     else {
-      file_descriptor_table[fileID].read_ptr = loc;
-      if (file_descriptor_table[fileID].descriptor_inode.size < loc) {
+      // making sure inode is current
+      read_inode(vol->file_descriptor_table[fileID].fd_inode_index, &vol->file_descriptor_table[fileID].descriptor_inode);
+      vol->file_descriptor_table[fileID].read_ptr = loc;
+      if (vol->file_descriptor_table[fileID].descriptor_inode.size < loc) {
         // if attempting to seek beyond end of file
-        file_descriptor_table[fileID].read_ptr = file_descriptor_table[fileID].descriptor_inode.size;
+        vol->file_descriptor_table[fileID].read_ptr = vol->file_descriptor_table[fileID].descriptor_inode.size;
       }
 
       return 0;
@@ -314,315 +1127,1539 @@ int ssfs_frseek(int fileID, int loc) {
 
 }
 
-// moves read pointer to new location, if in range
-// if new location is beyond file size, moves to end of file
+// moves write pointer to new location
+// seeking beyond the end of file is allowed: the gap becomes a hole that is only
+// given blocks once it is written to (see ssfs_fwrite)
 // returns 0 on success, -1 on failure
 int ssfs_fwseek(int fileID, int loc){
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("wseek %d %d", fileID, loc);
 
-  struct inode inode_block_to_read_from[16]; // making sure inode is current
-  read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block_to_read_from);
-  file_descriptor_table[fileID].descriptor_inode = inode_block_to_read_from[file_descriptor_table[fileID].fd_inode_index%16];
-
-  if (loc < 0 || fileID < 0 || fileID > 31 || file_descriptor_table[fileID].written == 0) {
+  if (loc < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
     // invalid seek
     return -1;
   }
 
-  else {
-    file_descriptor_table[fileID].write_ptr = loc;
-    if (file_descriptor_table[fileID].descriptor_inode.size < loc) {
-      // if attempting to seek beyond end of file
-      file_descriptor_table[fileID].write_ptr = file_descriptor_table[fileID].descriptor_inode.size;
-    }
-    return 0;
-  }
+  vol->file_descriptor_table[fileID].write_ptr = loc;
+  return 0;
 }
 
-// checks if this is the right inode to write to
-// if not, it recurses until it is
-// if it is, will write until inode blocks are full and then recurse to write to the next inode
-void ssfs_recursive_write(int starting_position, int inode_index, int buffer_index, char* buf, int length) {
-  if (starting_position > 14335) { // recursing to the next inode
-    struct inode inode_to_write;
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    inode_to_write = old_inode_block[inode_index%16];
-    ssfs_recursive_write(starting_position - 14336, inode_to_write.indirect, buffer_index, buf, length);
-    return;
-  } else {
-
-    // this is the right inode to write to
-    // get block of inodes to write to
-    struct inode inode_to_write;
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    inode_to_write = old_inode_block[inode_index%16];
+// counts what a write to bytes [start, end) of the file starting at inode_index would need:
+// data blocks for every hole in the range and anonymous inodes to extend the chain
+// holes are direct pointers equal to 0, as block 0 is the super block. shared blocks in the
+// range are counted too, as writing to them copies them
+void count_unallocated(int inode_index, int start, int end, int *blocks_needed, int *inodes_needed) {
+  *blocks_needed = 0;
+  *inodes_needed = 0;
+  if (end <= start) return;
+  int first_block = start/SFS_BLOCK_SIZE;
+  int last_block = (end - 1)/SFS_BLOCK_SIZE;
+
+  struct inode node;
+  int chain_no = 0; // position of inode_index in the chain
+  read_inode(inode_index, &node);
+  while (1) {
+    for (int i = 0; i < DIRECT_POINTERS; i++) {
+      int file_block = chain_no*DIRECT_POINTERS + i;
+      if (file_block >= first_block && file_block <= last_block
+          && (node.direct[i] == 0 || (!(node.direct[i] & POINTER_COMPRESSED) && block_refs(node.direct[i]) > 1))) {
+        (*blocks_needed)++;
+      }
+    }
+    for (int base = 0; base < DIRECT_POINTERS; base += EXTENT_BLOCKS) {
+      int extent_first = chain_no*DIRECT_POINTERS + base;
+      if (extent_first <= last_block && extent_first + EXTENT_BLOCKS > first_block) {
+        *blocks_needed += compressed_slots(&node, base); // written to, it is stored plainly again
+      }
+    }
+    if ((chain_no + 1)*DIRECT_POINTERS > last_block) return;
+    if (node.indirect <= 0) break;
+    read_inode(node.indirect, &node);
+    chain_no++;
+  }
 
-    int local_write_pointer = starting_position%1024; // position in block to write to
+  // rest of the range lies past the end of the chain: every block is a hole
+  for (int file_block = (chain_no + 1)*DIRECT_POINTERS; file_block <= last_block; file_block++) {
+    if (file_block >= first_block) (*blocks_needed)++;
+  }
+  *inodes_needed = last_block/DIRECT_POINTERS - chain_no;
+}
 
-    for (int i = starting_position/1024; i < 14 && buffer_index < length; i++) {
-      struct block write_to; // block to write to
-      read_blocks(inode_to_write.direct[i], 1, &write_to);
+// allocates, zeroes and links a new anonymous inode after the chain inode at inode_index
+// returns new inode index on success, -1 on failure
+int extend_chain(int inode_index, struct inode *node) {
+  int new_inode_index = get_null_inode();
+  if (new_inode_index < 0) {
+    return -1;
+  }
+  struct inode new_inode;
+  memset(&new_inode, 0, sizeof(new_inode));
+  write_inode(new_inode_index, &new_inode);
+  update_root_directory(new_inode_index, ANON_INODE_NAME);
+
+  node->indirect = new_inode_index;
+  write_inode(inode_index, node);
+  return new_inode_index;
+}
 
-      while (buffer_index < length && local_write_pointer < 1024) { // copying bytes to new block
-        memcpy(write_to.bytes+local_write_pointer, buf+buffer_index, 1);
-        local_write_pointer++;
-        buffer_index++;
+// checks the blocks a write to bytes [start, end) of the file starting at inode_index reads
+// back before inode_write changes anything: the allocated blocks at either end that the
+// write only covers in part (or, for fallocate, the shared blocks it copies), and the
+// compressed extents it inflates. with the blocks and
+// inodes reserved using count_unallocated, which include those of the inflated extents,
+// nothing else can make the write fail once it has started
+// returns 0 if the write can go ahead, -1 if one of the blocks failed its checksum
+int check_write_range(int inode_index, int start, int end, int holes_only) {
+  if (end <= start) return 0;
+  int first_block = start/SFS_BLOCK_SIZE;
+  int last_block = (end - 1)/SFS_BLOCK_SIZE;
+
+  struct inode node;
+  struct block data;
+  int chain_no = 0;
+  read_inode(inode_index, &node);
+  while (1) {
+    for (int i = 0; i < DIRECT_POINTERS; i++) {
+      int file_block = chain_no*DIRECT_POINTERS + i;
+      int pointer = node.direct[i];
+      if (file_block < first_block || file_block > last_block || pointer == 0 || (pointer & POINTER_COMPRESSED)) {
+        continue;
+      }
+      int partial = (file_block == first_block && (start%SFS_BLOCK_SIZE != 0 || end - start < SFS_BLOCK_SIZE))
+                    || (file_block == last_block && end%SFS_BLOCK_SIZE != 0);
+      int read_back = holes_only ? block_refs(pointer) > 1 : partial;
+      if (read_back && read_checked(pointer, 1, &data) < 0) {
+        return -1;
       }
-      write_blocks(inode_to_write.direct[i], 1, &write_to);
-      local_write_pointer = 0; // means next block starts from 0
     }
-    if (buffer_index < length) { // if there's more to write, recursively calling next inode to write to
-      ssfs_recursive_write(0, inode_to_write.indirect, buffer_index, buf, length);
-      return;
+    for (int base = 0; base < DIRECT_POINTERS; base += EXTENT_BLOCKS) {
+      if (compressed_slots(&node, base) == 0) continue;
+      int inflated = 0; // the write reaches a slot of the extent that it does not skip
+      for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+        int file_block = chain_no*DIRECT_POINTERS + i;
+        if (file_block >= first_block && file_block <= last_block && (!holes_only || node.direct[i] == 0)) {
+          inflated = 1;
+        }
+      }
+      if (inflated && load_extent(&node, base) == NULL) return -1;
     }
-    return;
+    if ((chain_no + 1)*DIRECT_POINTERS > last_block || node.indirect <= 0) return 0;
+    read_inode(node.indirect, &node);
+    chain_no++;
   }
 }
 
-// based on number of blocks, recursively allocates new inodes if necessary
-// returns 0 on success, -1 on failure
-// process:
-// 1. check if this is the right inode to be writing to
-// 2. assign blocks from new_blocks using blocks_before_write
-// 3. if more pointers needed, allocate new inode and recursively call
-int ssfs_recursive_allocate(int new_blocks[], int new_block_index, int num_blocks, int size, int blocks_before_write, int inode_index) {
-
-  struct inode inode_block[16];
-  read_blocks(inode_index/16 + 1, 1, &inode_block);
-  inode_block[inode_index%16].size = size;
-  write_blocks(inode_index/16 + 1, 1, &inode_block); // avoiding having more than 1 inode open across a recursive call
-  if (blocks_before_write > 14) { // passes through "chain" of inodes until appropriate
-    return ssfs_recursive_allocate(new_blocks, new_block_index, num_blocks, size, blocks_before_write - 14, inode_block[inode_index%16].indirect);
-  }
-  read_blocks(inode_index/16 + 1, 1, &inode_block);
-  // links blocks into inode
-  for (int i = blocks_before_write; i < 14 && new_block_index < num_blocks; i++) {
-    inode_block[inode_index%16].direct[i] = new_blocks[new_block_index++];
-  }
-
-  // "saving" inode to disc
-  inode_block[inode_index%16].size = size;
-  int new_inode_index;
-  if (new_block_index < num_blocks) { // if new inode is needed
-    new_inode_index = get_null_inode();
-    inode_block[inode_index%16].indirect = new_inode_index;
-  }
-  write_blocks(inode_index/16 + 1, 1, &inode_block);
-
-  // if new inode needed, creating new inode and then recursing into it
-  if (new_block_index < num_blocks) {
-
-    if (new_inode_index < 0) { // if failure getting new inode
-      return -1;
+// writes length bytes of buf into the file starting at inode_index, from byte position pos
+// walks the inode chain once, extending it where needed, and gives blocks only to holes
+// that are written to. the caller reserves the blocks/inodes using count_unallocated
+// and writes the fbm back afterwards
+// if holes_only is set, buf is ignored: holes in the range get zeroed blocks, shared blocks
+// get private copies and other allocated blocks are left as they are (used by fallocate)
+// shared blocks are copied on write. on volumes that deduplicate, a block whose new contents
+// match a block in use points at that block instead, and a write that leaves a block as it
+// was is skipped
+// the write is all-or-nothing: it fails before changing anything if a block or compressed
+// extent it reads back is corrupt, and cannot run out of blocks or inodes halfway through once they are reserved
+// returns number of bytes written on success, -1 on failure
+int inode_write(int inode_index, int pos, char *buf, int length, int holes_only) {
+  struct inode node;
+  int chain_no = 0;
+  int node_dirty = 0; // pointers were linked into node that must be written back
+  int written = 0;
+  if (check_write_range(inode_index, pos, pos + length, holes_only) < 0) return -1;
+  read_inode(inode_index, &node);
+
+  while (written < length) {
+    int file_block = (pos + written)/SFS_BLOCK_SIZE;
+    int local_write_pointer = (pos + written)%SFS_BLOCK_SIZE; // position in block to write to
+    int to_copy = SFS_BLOCK_SIZE - local_write_pointer;
+    if (to_copy > length - written) to_copy = length - written;
+
+    while (chain_no < file_block/DIRECT_POINTERS) { // moving down the chain to the right inode
+      if (node_dirty) {
+        write_inode(inode_index, &node);
+        node_dirty = 0;
+      }
+      int next = node.indirect;
+      if (next <= 0) {
+        next = extend_chain(inode_index, &node);
+        if (next < 0) return -1;
+      }
+      inode_index = next;
+      read_inode(inode_index, &node);
+      chain_no++;
     }
 
-    read_blocks(new_inode_index/16 + 1, 1, &inode_block);
-
-    inode_block[new_inode_index%16].size = size;
-    for (int i = 0; i < 14; i++) {
-      inode_block[new_inode_index%16].direct[i] = 0;
+    struct block write_to; // block to write to
+    int slot = file_block%DIRECT_POINTERS;
+    if (holes_only && node.direct[slot] != 0
+        && ((node.direct[slot] & POINTER_COMPRESSED) || block_refs(node.direct[slot]) == 1)) {
+      written += to_copy;
+      continue;
+    }
+    if (compressed_slots(&node, slot - slot%EXTENT_BLOCKS) > 0) { // compressed data is never patched in place
+      if (inflate_extent(&node, slot - slot%EXTENT_BLOCKS) < 0) return -1;
+      node_dirty = 1;
+    }
+    int pointer = node.direct[slot];
+    if (pointer == 0) { // filling a hole: nothing on disk worth reading
+      if (to_copy < SFS_BLOCK_SIZE || holes_only) memset(write_to.bytes, 0, SFS_BLOCK_SIZE);
+    } else if (to_copy < SFS_BLOCK_SIZE || holes_only) { // partial overwrite, or a shared block to copy
+      if (read_checked(pointer, 1, &write_to) < 0) return -1; // passed check_write_range, so not reached
+    }
+    if (!holes_only) {
+      memcpy(write_to.bytes + local_write_pointer, buf + written, to_copy);
     }
 
-    write_blocks(new_inode_index/16 + 1, 1, &inode_block);
-    update_root_directory(new_inode_index, "(anonIN)");
-
-    return ssfs_recursive_allocate(new_blocks, new_block_index, num_blocks, size, 0, new_inode_index);
+    int dedup = !holes_only && deduplicating();
+    unsigned int fingerprint = 0;
+    if (dedup) {
+      fingerprint = crc32c(&write_to, SFS_BLOCK_SIZE);
+      int duplicate = find_duplicate((char*)write_to.bytes, fingerprint);
+      if (duplicate != 0 && (duplicate == pointer || add_block_ref(duplicate) == 0)) {
+        if (duplicate != pointer) {
+          if (pointer != 0) release_block(pointer);
+          node.direct[slot] = duplicate;
+          node_dirty = 1;
+        }
+        written += to_copy;
+        continue;
+      }
+    }
+    if (pointer == 0 || block_refs(pointer) > 1) { // a hole, or a shared block that is copied
+      node.direct[slot] = get_empty_block();
+      if (node.direct[slot] < 0) {
+        node.direct[slot] = pointer;
+        break;
+      }
+      if (pointer != 0) release_block(pointer);
+      node_dirty = 1;
+    }
+    write_checked(node.direct[slot], 1, &write_to);
+    if (dedup) dedup_insert(fingerprint, node.direct[slot]);
+    written += to_copy;
+  }
 
+  if (node_dirty) {
+    write_inode(inode_index, &node);
+  }
+  return written < length ? -1 : written;
+}
+
+// reads length bytes from the file starting at inode_index, from byte position pos, into buf
+// holes (unallocated pointers, or positions past the end of the chain) read as zeroes
+// without touching the disk; contiguous blocks are read with a single disk_read call
+// returns 0 on success, -1 if a block failed its checksum
+int inode_read(int inode_index, int pos, char *buf, int length) {
+  struct inode node;
+  int chain_no = 0;
+  int chain_ended = 0;
+  int read = 0;
+  read_inode(inode_index, &node);
+
+  while (read < length) {
+    int file_block = (pos + read)/SFS_BLOCK_SIZE;
+    int local_read_pointer = (pos + read)%SFS_BLOCK_SIZE; // position in block to read from
+    int to_copy = SFS_BLOCK_SIZE - local_read_pointer;
+    if (to_copy > length - read) to_copy = length - read;
+
+    while (!chain_ended && chain_no < file_block/DIRECT_POINTERS) {
+      if (node.indirect <= 0) {
+        chain_ended = 1;
+        break;
+      }
+      read_inode(node.indirect, &node);
+      chain_no++;
+    }
+
+    int slot = file_block%DIRECT_POINTERS;
+    int pointer = chain_ended ? 0 : node.direct[slot];
+    if (pointer == 0) {
+      memset(buf + read, 0, to_copy);
+    } else if (pointer & POINTER_COMPRESSED) {
+      char *data = load_extent(&node, slot - slot%EXTENT_BLOCKS);
+      if (data == NULL) return -1;
+      memcpy(buf + read, data + stream_position(&node, slot)*SFS_BLOCK_SIZE + local_read_pointer, to_copy);
+    } else if (to_copy == SFS_BLOCK_SIZE) {
+      // whole blocks that sit next to each other on disk are read in one go, straight into buf
+      int run = 1;
+      while (slot + run < DIRECT_POINTERS && node.direct[slot + run] == pointer + run
+             && (run + 1)*SFS_BLOCK_SIZE <= length - read) {
+        run++;
+      }
+      if (read_checked(pointer, run, buf + read) < 0) return -1;
+      to_copy = run*SFS_BLOCK_SIZE;
+    } else {
+      struct block read_from; // block to read from
+      if (read_checked(pointer, 1, &read_from) < 0) return -1;
+      memcpy(buf + read, read_from.bytes + local_read_pointer, to_copy);
+    }
+    read += to_copy;
   }
   return 0;
 }
 
-// first determines new size, then allocates more blocks until size requirement is met
-// then calls recursive_allocate to put those blocks into inodes
-// then recursive_writes into those blocks
-// moves write pointer to byte past end of write
-// returns size of write on success, or -1 on failure
-int ssfs_fwrite(int fileID, char *buf, int length) {
+// counts the slots of the extent starting at slot base of node that are compressed
+// returns 0 if the extent is stored plainly
+int compressed_slots(struct inode *node, int base) {
+  int count = 0;
+  for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+    if (node->direct[i] & POINTER_COMPRESSED) count++;
+  }
+  return count;
+}
 
-  if (length < 0) {
-    return -1;
+// returns which block of its extent's decompressed data holds a compressed slot's data:
+// the number of compressed slots before it in the extent
+int stream_position(struct inode *node, int slot) {
+  int position = 0;
+  for (int i = slot - slot%EXTENT_BLOCKS; i < slot; i++) {
+    if (node->direct[i] & POINTER_COMPRESSED) position++;
   }
+  return position;
+}
 
-  struct inode inode_block_to_read_from[16]; // making sure inode is current
-  read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block_to_read_from);
-  file_descriptor_table[fileID].descriptor_inode = inode_block_to_read_from[file_descriptor_table[fileID].fd_inode_index%16];
-  int new_size = file_descriptor_table[fileID].descriptor_inode.size - (file_descriptor_table[fileID].descriptor_inode.size - file_descriptor_table[fileID].write_ptr) + length;
+// reads blocks[0..count) into buffer, reading blocks that sit next to each other in one go
+// returns 0 on success, -1 if a block failed its checksum
+int read_scattered(int *blocks, int count, char *buffer) {
+  for (int i = 0; i < count;) {
+    int run = 1;
+    while (i + run < count && blocks[i + run] == blocks[i] + run) run++;
+    if (read_checked(blocks[i], run, buffer + i*SFS_BLOCK_SIZE) < 0) return -1;
+    i += run;
+  }
+  return 0;
+}
 
-  if (new_size < file_descriptor_table[fileID].descriptor_inode.size) { // writing can never make a file size smaller...
-    new_size = file_descriptor_table[fileID].descriptor_inode.size;
+// decompresses the compressed extent starting at slot base of node
+// returns its data, one block per compressed slot in slot order, or NULL if it is corrupt
+// the data stays valid until the next call or the next write to the extent's blocks
+char *load_extent(struct inode *node, int base) {
+  int blocks[EXTENT_BLOCKS];
+  int num_blocks = 0;
+  int num_slots = compressed_slots(node, base);
+  for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+    if (POINTER_BLOCK(node->direct[i]) != 0) blocks[num_blocks++] = POINTER_BLOCK(node->direct[i]);
+  }
+  if (num_blocks > 0 && num_blocks == vol->extent_cache.num_blocks
+      && memcmp(blocks, vol->extent_cache.blocks, num_blocks*sizeof(int)) == 0) {
+    return vol->extent_cache.data;
   }
 
-  int current_no_of_blocks = file_descriptor_table[fileID].descriptor_inode.size/1024;
-  if (file_descriptor_table[fileID].descriptor_inode.size%1024 > 0) current_no_of_blocks++;
-  int blocks_needed = new_size/1024;
-  if(new_size%1024 > 0) blocks_needed++;
-  int blocks_to_allocate = blocks_needed - current_no_of_blocks;
+  struct block stream[EXTENT_BLOCKS];
+  int length;
+  vol->extent_cache.num_blocks = 0;
+  if (num_blocks == 0 || read_scattered(blocks, num_blocks, (char*)stream) < 0) return NULL;
+  memcpy(&length, stream, sizeof(int));
+  if (length < 0 || length > num_blocks*SFS_BLOCK_SIZE - (int)sizeof(int)
+      || lz_decompress((unsigned char*)stream + sizeof(int), length, (unsigned char*)vol->extent_cache.data,
+                       num_slots*SFS_BLOCK_SIZE) != num_slots*SFS_BLOCK_SIZE) {
+    fprintf(stderr, "SFS: compressed extent in block %d is corrupt\n", blocks[0]);
+    return NULL;
+  }
+  memcpy(vol->extent_cache.blocks, blocks, num_blocks*sizeof(int));
+  vol->extent_cache.num_blocks = num_blocks;
+  return vol->extent_cache.data;
+}
 
-  if (blocks_to_allocate > 0) { // allocates new memory
-    int *new_blocks;
-    new_blocks = malloc(blocks_to_allocate * 4);
+// stores the compressed extent starting at slot base of node plainly again, one block per
+// slot, so that it can be written to in place. the caller writes node and the fbm back
+// returns 0 on success, -1 on failure
+int inflate_extent(struct inode *node, int base) {
+  int num_slots = compressed_slots(node, base);
+  char *extent = load_extent(node, base);
+  if (extent == NULL) return -1;
+  char data[EXTENT_BLOCKS*SFS_BLOCK_SIZE];
+  memcpy(data, extent, num_slots*SFS_BLOCK_SIZE);
+
+  int new_blocks[EXTENT_BLOCKS];
+  for (int i = 0; i < num_slots; i++) {
+    new_blocks[i] = get_empty_block();
+    if (new_blocks[i] < 0) {
+      for (int j = 0; j < i; j++) vol->fbm.bytes[new_blocks[j]] = 1;
+      return -1;
+    }
+  }
+  int position = 0;
+  for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+    if (!(node->direct[i] & POINTER_COMPRESSED)) continue;
+    if (POINTER_BLOCK(node->direct[i]) != 0) release_block(POINTER_BLOCK(node->direct[i]));
+    write_checked(new_blocks[position], 1, data + position*SFS_BLOCK_SIZE);
+    node->direct[i] = new_blocks[position++];
+  }
+  return 0;
+}
 
-    for (int i = 0; i < blocks_to_allocate; i++) {
-      new_blocks[i] = get_empty_block();
-      if (new_blocks[i] < 0) { // failure to get a new block == bad write
-        for (int j = 0; j < i; j++) { // deallocating blocks that were just allocated
-          fbm.bytes[new_blocks[j]] = 1;
-        }
-        write_blocks(1023, 1, &fbm);
-        printf("block allocation fail\n");
-        free(new_blocks);
-        return -1;
-      }
+// compresses the plainly stored extent starting at slot base of node if that saves at least
+// one block; incompressible data is left as it is. the compressed stream goes to new blocks
+// before the old ones are released. shared blocks stay in use after being released, so
+// only the extent's unshared blocks count as saved. the caller writes node and the fbm back
+// returns number of blocks saved
+int compress_extent(struct inode *node, int base) {
+  int slots[EXTENT_BLOCKS], blocks[EXTENT_BLOCKS];
+  int num_slots = 0;
+  int unshared = 0;
+  if (compressed_slots(node, base) > 0) return 0;
+  for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+    if (node->direct[i] != 0) {
+      slots[num_slots] = i;
+      blocks[num_slots++] = node->direct[i];
+      if (block_refs(node->direct[i]) == 1) unshared++;
+    }
+  }
+  if (num_slots < 2 || unshared < 2) return 0;
+
+  char data[EXTENT_BLOCKS*SFS_BLOCK_SIZE];
+  struct block stream[EXTENT_BLOCKS];
+  if (read_scattered(blocks, num_slots, data) < 0) return 0;
+  int capacity = (unshared - 1)*SFS_BLOCK_SIZE - sizeof(int);
+  int length = lz_compress((unsigned char*)data, num_slots*SFS_BLOCK_SIZE, (unsigned char*)stream + sizeof(int), capacity);
+  if (length < 0) return 0;
+  memcpy(stream, &length, sizeof(int));
+  int num_blocks = (sizeof(int) + length + SFS_BLOCK_SIZE - 1)/SFS_BLOCK_SIZE;
+  memset((char*)stream + sizeof(int) + length, 0, num_blocks*SFS_BLOCK_SIZE - sizeof(int) - length);
+
+  int new_blocks[EXTENT_BLOCKS];
+  for (int i = 0; i < num_blocks; i++) {
+    new_blocks[i] = get_empty_block();
+    if (new_blocks[i] < 0) {
+      for (int j = 0; j < i; j++) vol->fbm.bytes[new_blocks[j]] = 1;
+      return 0;
     }
+    write_checked(new_blocks[i], 1, &stream[i]);
+  }
+  for (int i = 0; i < num_slots; i++) {
+    release_block(blocks[i]);
+    node->direct[slots[i]] = POINTER_COMPRESSED | (i < num_blocks ? new_blocks[i] : 0);
+  }
+  return unshared - num_blocks;
+}
 
-    // putting new blocks into inodes
-    if (ssfs_recursive_allocate(new_blocks, 0, blocks_to_allocate, new_size, current_no_of_blocks, file_descriptor_table[fileID].fd_inode_index) < 0) {
-      printf("allocation fail\n");
-      return -1;
+// compresses every plainly stored extent of the file starting at inode_index that shrinks
+// each changed inode is written once, and the fbm once at the end
+void compress_file(int inode_index) {
+  struct inode node;
+  int saved = 0;
+  while (inode_index > 0) {
+    read_inode(inode_index, &node);
+    int node_saved = 0;
+    for (int base = 0; base < DIRECT_POINTERS; base += EXTENT_BLOCKS) {
+      node_saved += compress_extent(&node, base);
     }
-    struct inode inode_block[16];
-    read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block);
-    file_descriptor_table[fileID].descriptor_inode = inode_block[file_descriptor_table[fileID].fd_inode_index%16];
-    write_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block);
-    free(new_blocks);
+    if (node_saved > 0) write_inode(inode_index, &node);
+    saved += node_saved;
+    inode_index = node.indirect;
   }
+  if (saved > 0) write_checked(FBM_BLOCK, 1, &vol->fbm);
+}
 
-  // writes to blocks/inodes, relying on the above to allocate enough memory
-  ssfs_recursive_write(file_descriptor_table[fileID].write_ptr, file_descriptor_table[fileID].fd_inode_index, 0, buf, length);
+// on volumes with compression on, compresses the files written to through open fds: just
+// the one starting at inode_index, or all of them if inode_index is -1
+// this is the write-back point for compression: files are compressed as they are closed,
+// committed or unmounted, so appends in between do not recompress the same extent
+void compress_modified(int inode_index) {
+  for (int i = 0; i < 32; i++) {
+    struct fd *file = &vol->file_descriptor_table[i];
+    if (!file->written || !file->modified || (inode_index >= 0 && file->fd_inode_index != inode_index)) continue;
+    for (int j = 0; j < 32; j++) {
+      if (vol->file_descriptor_table[j].fd_inode_index == file->fd_inode_index) vol->file_descriptor_table[j].modified = 0;
+    }
+    if (vol->super.compression == SFS_COMPRESSION_MAGIC) compress_file(file->fd_inode_index);
+  }
+}
 
-  // updating size in first file inode and fdt
-  struct inode fd_inode_block[16];
-  read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &fd_inode_block);
-  fd_inode_block[file_descriptor_table[fileID].fd_inode_index%16].size = new_size;
+// turns compression of the mounted volume on or off; the setting is kept in the super block
+// while it is on, files are compressed extent by extent when closed after being written to.
+// data already on disk stays as it is either way, and reads handle both
+// returns 0 on success, -1 if nothing is mounted
+int ssfs_vset_compression(int volume, int on) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  vol->super.compression = on ? SFS_COMPRESSION_MAGIC : 0;
+  write_checked(0, 1, &vol->super);
+  flush_checksums();
+  return 0;
+}
 
-  file_descriptor_table[fileID].descriptor_inode = fd_inode_block[file_descriptor_table[fileID].fd_inode_index%16];
-  write_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &fd_inode_block);
-  file_descriptor_table[fileID].write_ptr += length;
+int ssfs_set_compression(int on) {
+  return ssfs_vset_compression(0, on);
+}
 
-  return length;
+// true if the mounted volume shares written blocks with identical blocks already in use
+// the fingerprints come from the checksum table, so only volumes with one can deduplicate
+int deduplicating() {
+  return vol->super.dedup == SFS_DEDUP_MAGIC && has_checksums();
 }
 
-// returns bytes read on the heap.
-// process: if read doesn't start in this inode, recurses until it does
-// else, allocates a builder on the heap, loads correct blocks, and copies bytes into it
-// if read continues into next inode, it will copy
-// the result of a recursive call on the next inode and then free. NB: I'm proud of this one!
-char* ssfs_recursive_read(int starting_position, int left_to_read, int inode_index) {
-  if (starting_position > 14335) { // if this inode doesn't point to the first byte to read
-    struct inode inode_to_read;
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    inode_to_read = old_inode_block[inode_index%16];
-    return ssfs_recursive_read(starting_position - 14336, left_to_read, inode_to_read.indirect);
-
-  } else { // if this inode contains bytes to read
-    // initializing inode to read from
-    struct inode inode_to_read;
-    struct inode old_inode_block[16];
-    read_blocks(inode_index/16 + 1, 1, &old_inode_block);
-    inode_to_read = old_inode_block[inode_index%16];
-
-    char* builder = malloc(left_to_read); // string to return
-    int builder_write_pointer = 0; // index in builder to write to
-    int local_read_pointer = starting_position%1024; // position in block to read from
-    for (int i = starting_position/1024; i < 14 && left_to_read > 0; i++) {
-      struct block read_from; // block to read from
-      read_blocks(inode_to_read.direct[i], 1, &read_from);
-      while (left_to_read > 0 && local_read_pointer < 1024) { // copying bytes
-        builder[builder_write_pointer++] = read_from.bytes[local_read_pointer++];
-        left_to_read--;
-      }
-      local_read_pointer = 0; // means next block starts from 0
+// true if dedup index entry i names a block in use whose contents still match its fingerprint
+int dedup_entry_live(int i) {
+  int block = vol->dedup_index[i].block;
+  return block != 0 && vol->fbm.bytes[block] != 1 && vol->checksums[block] == vol->dedup_index[i].fingerprint;
+}
+
+// adds block, whose contents have the crc32c fingerprint, to the dedup index
+// a stale entry on the way is reused; the index is rebuilt once it gets too full of them
+void dedup_insert(unsigned int fingerprint, int block) {
+  int i = fingerprint%DEDUP_INDEX_SIZE;
+  while (vol->dedup_index[i].block != 0 && dedup_entry_live(i)) {
+    if (vol->dedup_index[i].block == block) return;
+    i = (i + 1)%DEDUP_INDEX_SIZE;
+  }
+  if (vol->dedup_index[i].block == 0) vol->dedup_index_used++;
+  vol->dedup_index[i].fingerprint = fingerprint;
+  vol->dedup_index[i].block = block;
+  if (vol->dedup_index_used > DEDUP_INDEX_SIZE*3/4) load_dedup_index(); // at most 1001 entries are live
+}
+
+// (re)builds the dedup index from the checksums of every data block in use
+void load_dedup_index() {
+  load_fbm();
+  load_checksums();
+  memset(vol->dedup_index, 0, sizeof(vol->dedup_index));
+  vol->dedup_index_used = 0;
+  vol->dedup_index_loaded = 1;
+  for (int i = FIRST_DATA_BLOCK; i < CHECKSUM_BLOCK; i++) {
+    if (vol->fbm.bytes[i] != 1) dedup_insert(vol->checksums[i], i);
+  }
+}
+
+// looks up a data block in use holding the same bytes as data, whose crc32c is fingerprint
+// only blocks with the same fingerprint are read, to rule out crc32c collisions, so a
+// lookup that finds nothing costs no disk access at all
+// returns the block, or 0 if there is none
+int find_duplicate(char *data, unsigned int fingerprint) {
+  if (!vol->dedup_index_loaded) load_dedup_index();
+  for (int i = fingerprint%DEDUP_INDEX_SIZE; vol->dedup_index[i].block != 0; i = (i + 1)%DEDUP_INDEX_SIZE) {
+    if (vol->dedup_index[i].fingerprint != fingerprint || !dedup_entry_live(i)) continue;
+    struct block candidate;
+    if (read_checked(vol->dedup_index[i].block, 1, &candidate) >= 0 && memcmp(candidate.bytes, data, SFS_BLOCK_SIZE) == 0) {
+      return vol->dedup_index[i].block;
     }
-    if (left_to_read > 0) { // recursively calling next inode
-      char* rec_result = ssfs_recursive_read(0, left_to_read, inode_to_read.indirect);
-      memcpy(builder+builder_write_pointer, rec_result, left_to_read);
-      free(rec_result);
-    } // builder contains all the requested data
-    return builder;
   }
+  return 0;
+}
+
+// turns deduplication of the mounted volume on or off; the setting is kept in the super block
+// while it is on, every block written through ssfs_fwrite that matches a block already in
+// use points at that block instead of taking a new one. shared blocks are copied on write,
+// so files never see each other's changes
+// returns 0 on success, -1 if nothing is mounted or the volume has no checksum table
+int ssfs_vset_dedup(int volume, int on) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  if (!has_checksums()) {
+    return -1;
+  }
+  vol->super.dedup = on ? SFS_DEDUP_MAGIC : 0;
+  write_checked(0, 1, &vol->super);
+  flush_checksums();
+  return 0;
 }
 
-// will read from read pointer into buffer for length of read using recursive_read
+int ssfs_set_dedup(int on) {
+  return ssfs_vset_dedup(0, on);
+}
+
+// writes buf at the write pointer, growing the file if the write ends beyond EOF
+// blocks are only allocated for the holes the write covers, so writing after a seek
+// past EOF leaves the gap unallocated. the write is all-or-nothing: if there are not
+// enough free blocks/inodes for it, or data it has to read back fails its checksum,
+// nothing is written
+// moves write pointer to byte past end of write
+// returns size of write on success, or -1 on failure
+int ssfs_fwrite(int fileID, char *buf, int length) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("write %d %d", fileID, length);
+
+  if (length < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
+    return -1;
+  }
+
+  struct fd *file = &vol->file_descriptor_table[fileID];
+  read_inode(file->fd_inode_index, &file->descriptor_inode); // making sure inode is current
+  int new_size = file->write_ptr + length;
+  if (new_size < file->descriptor_inode.size) { // writing can never make a file size smaller...
+    new_size = file->descriptor_inode.size;
+  }
+
+  int blocks_needed, inodes_needed;
+  count_unallocated(file->fd_inode_index, file->write_ptr, file->write_ptr + length, &blocks_needed, &inodes_needed);
+  if (blocks_needed > count_free_blocks() || inodes_needed > count_null_inodes()) {
+    printf("block allocation fail\n");
+    return -1;
+  }
+
+  if (inode_write(file->fd_inode_index, file->write_ptr, buf, length, 0) < 0) { // nothing was changed
+    printf("write fail\n");
+    return -1;
+  }
+  if (blocks_needed > 0 || vol->fbm_dirty) {
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+    vol->fbm_dirty = 0;
+  }
+
+  // updating size in first file inode and fdt
+  read_inode(file->fd_inode_index, &file->descriptor_inode);
+  file->descriptor_inode.size = new_size;
+  write_inode(file->fd_inode_index, &file->descriptor_inode);
+  drop_mapped_pages(file->fd_inode_index, file->write_ptr, file->write_ptr + length);
+  file->write_ptr += length;
+  file->modified = 1;
+  flush_checksums();
+
+  return length;
+}
+
+// reserves zeroed blocks for bytes [offset, offset + length) of the file so that later
+// writes to the range cannot fail for lack of space. blocks the file shares with another
+// (after a clone, or on a volume that deduplicates) get private copies, since writing to
+// them would copy them; other allocated blocks are left untouched. compressed extents are
+// the exception: they stay compressed, so a later write into one still needs blocks to
+// inflate it. the file grows if the range ends beyond EOF
+// returns 0 on success, -1 on failure
+int ssfs_fallocate(int fileID, int offset, int length) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("fallocate %d %d %d", fileID, offset, length);
+
+  if (offset < 0 || length < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
+    return -1;
+  }
+
+  struct fd *file = &vol->file_descriptor_table[fileID];
+  int blocks_needed, inodes_needed;
+  count_unallocated(file->fd_inode_index, offset, offset + length, &blocks_needed, &inodes_needed);
+  if (blocks_needed > count_free_blocks() || inodes_needed > count_null_inodes()) {
+    return -1;
+  }
+
+  if (inode_write(file->fd_inode_index, offset, NULL, length, 1) < 0) { // nothing was changed
+    return -1;
+  }
+  if (blocks_needed > 0) {
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+
+  read_inode(file->fd_inode_index, &file->descriptor_inode);
+  if (offset + length > file->descriptor_inode.size) {
+    file->descriptor_inode.size = offset + length;
+    write_inode(file->fd_inode_index, &file->descriptor_inode);
+  }
+  file->modified = 1;
+  flush_checksums();
+  return 0;
+}
+
+// will read from read pointer into buffer for length of read using inode_read
 // will not read beyond EOF, but if a longer read is requested, will truncate
 // moves the read pointer to point to byte past end of read
 // returns length of read on success, -1 on failure
 int ssfs_fread(int fileID, char *buf, int length){
-
-  struct inode inode_block_to_read_from[16]; // making sure inode is current
-  read_blocks(file_descriptor_table[fileID].fd_inode_index/16 + 1, 1, &inode_block_to_read_from);
-  file_descriptor_table[fileID].descriptor_inode = inode_block_to_read_from[file_descriptor_table[fileID].fd_inode_index%16];
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("read %d %d", fileID, length);
 
   // check for valid read
-  if (fileID < 0 || fileID > 31 || file_descriptor_table[fileID].written == 0 || length < 0) {
+  if (fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0 || length < 0) {
     return -1;
   }
 
+  struct fd *file = &vol->file_descriptor_table[fileID];
+  read_inode(file->fd_inode_index, &file->descriptor_inode); // making sure inode is current
+
   // if attempting to read beyond EOF, truncating
-  if (length + file_descriptor_table[fileID].read_ptr > file_descriptor_table[fileID].descriptor_inode.size) {
-    length = file_descriptor_table[fileID].descriptor_inode.size - file_descriptor_table[fileID].read_ptr;
+  if (length + file->read_ptr > file->descriptor_inode.size) {
+    length = file->descriptor_inode.size - file->read_ptr;
   }
+  if (length < 0) length = 0;
 
-  // recursive_read returns string on heap
-  char* rec_result = ssfs_recursive_read(file_descriptor_table[fileID].read_ptr, length, file_descriptor_table[fileID].fd_inode_index);
-  strncpy(buf, rec_result, length); // copies into buffer, frees allocated mem
-  free(rec_result);
-  file_descriptor_table[fileID].read_ptr += length;
+  if (inode_read(file->fd_inode_index, file->read_ptr, buf, length) < 0) {
+    return -1; // corrupt data is never handed out; the read pointer stays put
+  }
+  file->read_ptr += length;
   return length;
 }
 
-// removes and zeroes inodes, then recursively calls on the indirect inode it points to if necessary
-int remove_inode(int dir_index) {
-  struct inode inode_to_read;
-  struct inode old_inode_block[16];
-  read_blocks(dir_index/16 + 1, 1, &old_inode_block);
-  inode_to_read = old_inode_block[dir_index%16];
-  int linked_inode = inode_to_read.indirect;
+// frees the data blocks of file blocks [first_block, last_block] in the chain starting at
+// inode_index (shared blocks lose a pointer); pointers are reset to holes and each changed
+// inode is written once
+// the fbm is only changed in memory, so a whole range costs one fbm write by the caller
+// returns number of blocks freed
+int free_block_range(int inode_index, int first_block, int last_block) {
+  struct inode node;
+  int chain_no = 0;
+  int freed = 0;
+  load_fbm();
+  while (inode_index > 0 && chain_no*DIRECT_POINTERS <= last_block) {
+    read_inode(inode_index, &node);
+    int node_dirty = 0;
+    int keep[DIRECT_POINTERS/EXTENT_BLOCKS] = {0}; // compressed extents that must stay whole
+    for (int base = 0; base < DIRECT_POINTERS; base += EXTENT_BLOCKS) {
+      // a compressed extent only partly in the range is stored plainly first
+      int inside = 0, outside = 0;
+      for (int i = base; i < base + EXTENT_BLOCKS; i++) {
+        int file_block = chain_no*DIRECT_POINTERS + i;
+        if (!(node.direct[i] & POINTER_COMPRESSED)) continue;
+        if (file_block >= first_block && file_block <= last_block) inside++;
+        else outside++;
+      }
+      if (inside > 0 && outside > 0) {
+        if (inflate_extent(&node, base) < 0) keep[base/EXTENT_BLOCKS] = 1; // out of space: left as it is
+        else node_dirty = 1;
+      }
+    }
+    for (int i = 0; i < DIRECT_POINTERS; i++) {
+      int file_block = chain_no*DIRECT_POINTERS + i;
+      if (file_block >= first_block && file_block <= last_block && node.direct[i] != 0 && !keep[i/EXTENT_BLOCKS]) {
+        if (POINTER_BLOCK(node.direct[i]) != 0) release_block(POINTER_BLOCK(node.direct[i]));
+        node.direct[i] = 0;
+        node_dirty = 1;
+        freed++;
+      }
+    }
+    if (node_dirty) write_inode(inode_index, &node);
+    inode_index = node.indirect;
+    chain_no++;
+  }
+  return freed;
+}
 
-  for (int i = 0; i < 14; i++) { // updating fbm
-    fbm.bytes[inode_to_read.direct[i]] = 1;
+// frees every data block and inode of the chain starting at inode_index; shared blocks
+// only lose a pointer
+// updates the fbm and root directory in memory only; the caller writes both back once
+void free_chain(int inode_index) {
+  struct inode node;
+  struct inode empty_inode;
+  memset(&empty_inode, 0, sizeof(empty_inode));
+  load_fbm();
+  while (inode_index > 0) {
+    read_inode(inode_index, &node);
+    for (int i = 0; i < DIRECT_POINTERS; i++) {
+      if (POINTER_BLOCK(node.direct[i]) != 0) release_block(POINTER_BLOCK(node.direct[i]));
+    }
+    write_inode(inode_index, &empty_inode);
+    vol->root_directory[inode_index][0] = '\0';
+    inode_index = node.indirect;
   }
-  write_blocks(1023, 1, &fbm);
+}
 
-  memset(&old_inode_block[dir_index%16], 0, 64); // zeroing inode
-  write_blocks(dir_index/16 + 1, 1, &old_inode_block);
+// zeroes bytes [start, end) of the file starting at inode_index, which must lie in a single
+// block; holes are left alone since they already read as zeroes
+// returns 0 on success, -1 if the block failed its checksum (it is left as it is rather
+// than rewritten with a fresh checksum) or could not be copied or inflated
+int zero_partial_block(int inode_index, int start, int end) {
+  if (end <= start) return 0;
+  int file_block = start/SFS_BLOCK_SIZE;
+  struct inode node;
+  read_inode(inode_index, &node);
+  for (int chain_no = 0; chain_no < file_block/DIRECT_POINTERS; chain_no++) {
+    if (node.indirect <= 0) return 0;
+    inode_index = node.indirect;
+    read_inode(inode_index, &node);
+  }
+  int slot = file_block%DIRECT_POINTERS;
+  if (node.direct[slot] & POINTER_COMPRESSED) { // stored plainly, so that the block can be patched
+    if (inflate_extent(&node, slot - slot%EXTENT_BLOCKS) < 0) return -1;
+    write_inode(inode_index, &node);
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+  int pointer = node.direct[slot];
+  if (pointer == 0) return 0;
+  struct block partial;
+  if (read_checked(pointer, 1, &partial) < 0) return -1;
+  memset(partial.bytes + start%SFS_BLOCK_SIZE, 0, end - start);
+  if (block_refs(pointer) > 1) { // a shared block is copied rather than zeroed under other files
+    int copy = get_empty_block();
+    if (copy < 0) return -1;
+    release_block(pointer);
+    node.direct[slot] = pointer = copy;
+    write_inode(inode_index, &node);
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+  write_checked(pointer, 1, &partial);
+  return 0;
+}
 
-  char *nuller = "\0";
-  update_root_directory(dir_index, nuller);
+// sets the size of the file to size. shrinking frees every block and chained inode past the
+// new end in one pass, with a single fbm and root directory write; growing leaves a hole
+// read and write pointers beyond the new end are moved back to it
+// returns 0 on success, -1 on failure
+int ssfs_ftruncate(int fileID, int size) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("truncate %d %d", fileID, size);
 
-  if (linked_inode > 0) { // recursively updating indirect inodes
-    return remove_inode(linked_inode);
+  if (size < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
+    return -1;
   }
+
+  struct fd *file = &vol->file_descriptor_table[fileID];
+  read_inode(file->fd_inode_index, &file->descriptor_inode); // making sure inode is current
+
+  if (size < file->descriptor_inode.size) {
+    drop_mapped_pages(file->fd_inode_index, size, file->descriptor_inode.size);
+    // bytes left in the last kept block must read as zeroes if the file grows again
+    if (size%SFS_BLOCK_SIZE != 0) {
+      int block_end = (size/SFS_BLOCK_SIZE + 1)*SFS_BLOCK_SIZE;
+      if (block_end > file->descriptor_inode.size) block_end = file->descriptor_inode.size;
+      if (zero_partial_block(file->fd_inode_index, size, block_end) < 0) {
+        flush_checksums();
+        return -1;
+      }
+    }
+
+    int blocks_kept = (size + SFS_BLOCK_SIZE - 1)/SFS_BLOCK_SIZE;
+    int inodes_kept = blocks_kept/DIRECT_POINTERS + 1; // head inode is always kept
+    if (blocks_kept%DIRECT_POINTERS == 0 && blocks_kept > 0) inodes_kept--;
+
+    // unlinking the chained inodes that will no longer be needed
+    int inode_index = file->fd_inode_index;
+    struct inode node;
+    read_inode(inode_index, &node);
+    for (int i = 1; i < inodes_kept && node.indirect > 0; i++) {
+      inode_index = node.indirect;
+      read_inode(inode_index, &node);
+    }
+    int cut_chain = node.indirect;
+    if (cut_chain > 0) {
+      node.indirect = 0;
+      write_inode(inode_index, &node);
+      load_root_directory();
+      free_chain(cut_chain);
+      write_checked(ROOT_DIR_BLOCK, 4, &vol->root_directory);
+    }
+    free_block_range(file->fd_inode_index, blocks_kept, (inodes_kept*DIRECT_POINTERS) - 1);
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+
+  read_inode(file->fd_inode_index, &file->descriptor_inode);
+  file->descriptor_inode.size = size;
+  write_inode(file->fd_inode_index, &file->descriptor_inode);
+  for (int i = 0; i < 32; i++) { // every fd open on the file must stay within it
+    if (vol->file_descriptor_table[i].written == 1 && vol->file_descriptor_table[i].fd_inode_index == file->fd_inode_index) {
+      if (vol->file_descriptor_table[i].read_ptr > size) vol->file_descriptor_table[i].read_ptr = size;
+      if (vol->file_descriptor_table[i].write_ptr > size) vol->file_descriptor_table[i].write_ptr = size;
+      vol->file_descriptor_table[i].descriptor_inode = file->descriptor_inode;
+    }
+  }
+  flush_checksums();
   return 0;
 }
 
-// removes all files with the same name from the directory
+// deallocates bytes [offset, offset + length) of the file, which then read as zeroes
+// whole blocks in the range are freed with a single fbm write; partial blocks at either
+// end are zeroed in place. the file size never changes
 // returns 0 on success, -1 on failure
-int ssfs_remove(char *file) {
-  for (int i = 0; i < 200; i++) { // attempts to remove all files of the same name
+int ssfs_punch_hole(int fileID, int offset, int length) {
+  if (use_fd(&fileID) < 0) {
+    return -1;
+  }
+  trace_op("punch %d %d %d", fileID, offset, length);
+
+  if (offset < 0 || length < 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
+    return -1;
+  }
+
+  struct fd *file = &vol->file_descriptor_table[fileID];
+  read_inode(file->fd_inode_index, &file->descriptor_inode); // making sure inode is current
+  int end = offset + length;
+  if (end > file->descriptor_inode.size) end = file->descriptor_inode.size;
+  if (end <= offset) return 0;
+  drop_mapped_pages(file->fd_inode_index, offset, end);
+
+  int first_whole = (offset + SFS_BLOCK_SIZE - 1)/SFS_BLOCK_SIZE;
+  int last_whole = end/SFS_BLOCK_SIZE - 1;
+  if (end == file->descriptor_inode.size) { // a partial last block of the file is dropped whole
+    last_whole = (end - 1)/SFS_BLOCK_SIZE;
+  }
+
+  if (first_whole > last_whole) { // range lies inside a single block
+    int result = zero_partial_block(file->fd_inode_index, offset, end);
+    flush_checksums();
+    return result;
+  }
+  if (zero_partial_block(file->fd_inode_index, offset, first_whole*SFS_BLOCK_SIZE) < 0 ||
+      (end < file->descriptor_inode.size && zero_partial_block(file->fd_inode_index, (last_whole + 1)*SFS_BLOCK_SIZE, end) < 0)) {
+    flush_checksums(); // no whole block is freed for a range whose ends could not be zeroed
+    return -1;
+  }
+  if (free_block_range(file->fd_inode_index, first_whole, last_whole) > 0) {
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+  flush_checksums();
+  return 0;
+}
+
+// removes and zeroes a file's inode and every inode chained to it
+// all of the file's blocks are freed with a single fbm write and a single root directory write
+int remove_inode(int dir_index) {
+  load_root_directory();
+  free_chain(dir_index);
+  write_checked(FBM_BLOCK, 1, &vol->fbm);
+  write_checked(ROOT_DIR_BLOCK, 4, &vol->root_directory);
+  flush_checksums();
+  return 0;
+}
 
-    int inode_to_remove = get_inode_from_name(file);
-    if (inode_to_remove < 0) return 0;
-    if (inode_to_remove == 0) { // if file is not found
+// fills fname with the next file name in the root directory, skipping chained inodes
+// only top-level names of up to 15 bytes are listed; directories are listed like files
+// returns 1 while there are names left, 0 (and restarts from the first file) at the end
+int ssfs_vgetnextfilename(int volume, char *fname) {
+  if (use_volume(volume) < 0) {
+    return 0;
+  }
+  load_root_directory();
+  for (; vol->next_file < 200; vol->next_file++) {
+    if (vol->root_directory[vol->next_file][0] != 0 && !is_marker(vol->root_directory[vol->next_file])) {
+      strncpy(fname, vol->root_directory[vol->next_file], 16);
+      vol->next_file++;
+      return 1;
+    }
+  }
+  vol->next_file = 1; // 0 is the root directory itself
+  return 0;
+}
+
+int ssfs_getnextfilename(char *fname) {
+  return ssfs_vgetnextfilename(0, fname);
+}
+
+// a data block of a file, in file order, with where its pointer lives in the chain
+struct block_ref {
+  int inode_index;
+  int slot;
+  int pointer;
+} block_ref_t;
+
+// collects the allocated blocks of the file starting at inode_index, in file order
+// holes, and slots of compressed extents that hold no block, are skipped; refs must have
+// room for every data block of the volume
+// returns number of blocks collected
+int collect_blocks(int inode_index, struct block_ref *refs) {
+  int count = 0;
+  struct inode node;
+  while (inode_index > 0) {
+    read_inode(inode_index, &node);
+    for (int i = 0; i < DIRECT_POINTERS; i++) {
+      if (POINTER_BLOCK(node.direct[i]) != 0) {
+        refs[count].inode_index = inode_index;
+        refs[count].slot = i;
+        refs[count].pointer = POINTER_BLOCK(node.direct[i]);
+        count++;
+      }
+    }
+    inode_index = node.indirect;
+  }
+  return count;
+}
+
+// scores how scattered a file's blocks are: the percentage of consecutive pairs of
+// allocated blocks that are not next to each other on disk
+// 0 means one contiguous run; holes do not count as breaks
+// returns the score on success, -1 if the file does not exist
+int ssfs_vfrag_score(int volume, char *name) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  int inode_index = find_path(name);
+  if (inode_index <= 0) {
+    return -1;
+  }
+  struct block_ref refs[FBM_BLOCK];
+  int count = collect_blocks(inode_index, refs);
+  if (count < 2) return 0;
+  int breaks = 0;
+  for (int i = 1; i < count; i++) {
+    if (refs[i].pointer != refs[i-1].pointer + 1) breaks++;
+  }
+  return breaks*100/(count - 1);
+}
+
+int ssfs_frag_score(char *name) {
+  return ssfs_vfrag_score(0, name);
+}
+
+// finds the lowest run of length free blocks in the fbm, so defragmented files are packed
+// towards the start of the volume
+// returns first block of the run, or -1 if there is none
+int find_free_run(int length) {
+  load_fbm();
+  int run = 0;
+  for (int i = FIRST_DATA_BLOCK; i < FBM_BLOCK; i++) {
+    run = vol->fbm.bytes[i] == 1 ? run + 1 : 0;
+    if (run == length) return i - length + 1;
+  }
+  return -1;
+}
+
+// relocates the blocks of the file starting at inode_index into one contiguous run
+// the move is ordered so that a crash at any point leaves a readable file:
+// 1. the new run is marked used and the fbm written, 2. data is copied into the run,
+// 3. inode pointers are switched over, each chain inode in a single block write,
+// 4. the old blocks are freed with one more fbm write.
+// until step 3 completes for an inode its pointers still name the old, unchanged copies,
+// so the worst a crash can do is leak blocks. files that share blocks are left where they
+// are, as moving them would copy the shared blocks and undo the sharing, and a file with a
+// block failing its checksum is not moved at all, so the move cannot make it look valid
+// returns number of blocks moved, 0 if the file was already contiguous, -1 on failure
+int defrag_file(int inode_index) {
+  struct block_ref refs[FBM_BLOCK];
+  int count = collect_blocks(inode_index, refs);
+  int contiguous = 1;
+  for (int i = 0; i < count; i++) {
+    if (i > 0 && refs[i].pointer != refs[i-1].pointer + 1) contiguous = 0;
+    if (block_refs(refs[i].pointer) > 1) return 0;
+  }
+  if (count == 0 || contiguous) return 0;
+
+  int run_start = find_free_run(count);
+  if (run_start < 0) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    vol->fbm.bytes[run_start + i] = 0;
+  }
+  write_checked(FBM_BLOCK, 1, &vol->fbm);
+
+  struct block moving;
+  for (int i = 0; i < count; i++) {
+    if (read_checked(refs[i].pointer, 1, &moving) < 0) { // not re-checksumming corrupt data
+      for (int j = 0; j < count; j++) {
+        vol->fbm.bytes[run_start + j] = 1;
+      }
+      write_checked(FBM_BLOCK, 1, &vol->fbm);
+      flush_checksums();
       return -1;
     }
+    write_checked(run_start + i, 1, &moving);
+  }
+
+  struct inode node;
+  for (int i = 0; i < count; i++) {
+    if (i == 0 || refs[i].inode_index != refs[i-1].inode_index) {
+      read_inode(refs[i].inode_index, &node);
+    }
+    node.direct[refs[i].slot] = (node.direct[refs[i].slot] & POINTER_COMPRESSED) | (run_start + i);
+    if (i == count - 1 || refs[i+1].inode_index != refs[i].inode_index) {
+      write_inode(refs[i].inode_index, &node);
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    release_block(refs[i].pointer);
+  }
+  write_checked(FBM_BLOCK, 1, &vol->fbm);
+
+  for (int i = 0; i < 32; i++) { // open fds keep a copy of the head inode
+    if (vol->file_descriptor_table[i].written == 1 && vol->file_descriptor_table[i].fd_inode_index == inode_index) {
+      read_inode(inode_index, &vol->file_descriptor_table[i].descriptor_inode);
+    }
+  }
+  flush_checksums();
+  return count;
+}
+
+// defragments the file called name; see defrag_file
+int ssfs_vdefrag(int volume, char *name) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  int inode_index = find_path(name);
+  if (inode_index <= 0) {
+    return -1;
+  }
+  return defrag_file(inode_index);
+}
 
-    for (int i = 0; i < 32; i++) { // must remove from fdt
-      struct inode inode_block_to_read_from[16]; // making sure inode is current
-      read_blocks(file_descriptor_table[i].fd_inode_index/16 + 1, 1, &inode_block_to_read_from);
-      file_descriptor_table[i].descriptor_inode = inode_block_to_read_from[file_descriptor_table[i].fd_inode_index%16];
-      if (file_descriptor_table[i].fd_inode_index == inode_to_remove) {
-        if (ssfs_fclose(i) < 0) {
-          file_descriptor_table[i].written = 0;
+int ssfs_defrag(char *name) {
+  return ssfs_vdefrag(0, name);
+}
+
+// compacts the volume: defragments every file and directory, packing each into the lowest
+// free run. they are found through the head inodes in the root directory, so files reached
+// through directories are included and the getnextfilename cursor is left where it is
+// files that find no run on the first pass are retried once the others have moved,
+// as compaction tends to open up space at the end of the volume
+// returns number of blocks moved, or -1 if a file could not be compacted on either pass
+// (the others are compacted all the same)
+int ssfs_vdefrag_all(int volume) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  load_root_directory();
+  char failed[200] = {0};
+  int moved = 0;
+  int num_failed = 0;
+  for (int i = 1; i < 200; i++) {
+    if (vol->root_directory[i][0] == 0 || strcmp(vol->root_directory[i], ANON_INODE_NAME) == 0) continue;
+    int result = defrag_file(i);
+    if (result < 0) {
+      failed[i] = 1;
+      num_failed++;
+    } else {
+      moved += result;
+    }
+  }
+  for (int i = 1; num_failed > 0 && i < 200; i++) {
+    if (!failed[i]) continue;
+    int result = defrag_file(i);
+    if (result < 0) continue;
+    moved += result;
+    num_failed--;
+  }
+  return num_failed > 0 ? -1 : moved;
+}
+
+int ssfs_defrag_all() {
+  return ssfs_vdefrag_all(0);
+}
+
+// checks every block in use against its checksum, reporting the ones that fail
+// returns number of corrupt blocks, or -1 if the volume has no checksums
+int ssfs_vverify(int volume) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  if (!has_checksums()) {
+    return -1;
+  }
+  load_fbm();
+  int corrupt = 0;
+  struct block checking;
+  for (int i = 0; i < SFS_NUM_BLOCKS; i++) {
+    if (i >= CHECKSUM_BLOCK && i < FBM_BLOCK) continue; // the table does not cover itself
+    if (i >= FIRST_DATA_BLOCK && i < FBM_BLOCK && vol->fbm.bytes[i] == 1) continue;
+    if (read_checked(i, 1, &checking) < 0) corrupt++;
+  }
+  return corrupt;
+}
+
+int ssfs_verify() {
+  return ssfs_vverify(0);
+}
+
+// reads page of mapping m in from its file; bytes past the end of the file read as zeroes
+// returns 0 on success, -1 if a block failed its checksum
+int read_page(struct mapping *m, int page) {
+  char *addr = m->addr + page*page_size;
+  int start = m->offset + page*page_size;
+  struct inode head;
+  read_inode(m->inode_index, &head);
+  int length = head.size - start;
+  if (length > page_size) length = page_size;
+  if (length < 0) length = 0;
+  mprotect(addr, page_size, PROT_READ | PROT_WRITE);
+  memset(addr + length, 0, page_size - length);
+  if (inode_read(m->inode_index, start, addr, length) < 0) return -1;
+  mprotect(addr, page_size, PROT_READ);
+  m->pages[page] = PAGE_CLEAN;
+  return 0;
+}
+
+// SIGSEGV handler that does the page-granular faulting of mappings: touching a page that
+// is not read in yet reads it in read-only, and writing to a clean page marks it dirty and
+// makes it writable. a page that cannot be read raises SIGBUS, as an I/O error under mmap
+// does. faults outside every mapping go to the handler that was installed before, which is
+// called rather than reinstalled, so this one keeps handling the mappings afterwards
+// reading a page in runs the same code as ssfs_fread (stdio, malloc), which is not
+// async-signal-safe: it is only safe because the fault comes from the faulting thread's own
+// access, so see ssfs_mmap for what mapped memory must not be handed to
+void mapping_fault(int signal_number, siginfo_t *info, void *context) {
+  char *address = info->si_addr;
+  for (int i = 0; i < 32; i++) {
+    struct mapping *m = &mappings[i];
+    if (m->addr == NULL || address < m->addr || address >= m->addr + m->num_pages*page_size) continue;
+    int page = (address - m->addr)/page_size;
+    if (m->pages[page] == PAGE_ABSENT) {
+      struct volume *interrupted = vol; // the fault can come between any two api calls
+      vol = m->volume;
+      int result = read_page(m, page);
+      vol = interrupted;
+      if (result < 0) {
+        signal(SIGBUS, SIG_DFL);
+        raise(SIGBUS);
+      }
+    } else {
+      mprotect(m->addr + page*page_size, page_size, PROT_READ | PROT_WRITE);
+      m->pages[page] = PAGE_DIRTY;
+    }
+    return;
+  }
+  if (previous_segv.sa_flags & SA_SIGINFO) {
+    previous_segv.sa_sigaction(signal_number, info, context);
+  } else if (previous_segv.sa_handler != SIG_DFL && previous_segv.sa_handler != SIG_IGN) {
+    previous_segv.sa_handler(signal_number);
+  } else { // returning re-runs the access, which then ends the process as it would have
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+// maps bytes [offset, offset + length) of an open file into memory, so that they can be
+// read and written through a pointer. pages are read in as they are first touched, and
+// pages written to are written back to the file by ssfs_msync, and when the file is
+// closed or the volume unmounted, which also unmap it. bytes past the end of the file
+// read as zeroes and are never written back; a mapping does not grow the file
+// mapped memory must not be passed to ssfs_* calls, whose reads could fault inside them, nor
+// to libc calls that hold a lock while reading it, like fwrite or printf: the fault handler
+// reads pages in with stdio and malloc too, and would block on that lock. calls that only
+// touch memory, like memcpy or memcmp, are fine
+// returns the start of the mapping on success, NULL on failure
+void *ssfs_mmap(int fileID, int offset, int length) {
+  if (use_fd(&fileID) < 0) {
+    return NULL;
+  }
+  if (offset < 0 || length <= 0 || fileID < 0 || fileID > 31 || vol->file_descriptor_table[fileID].written == 0) {
+    return NULL;
+  }
+  if (page_size == 0) {
+    page_size = sysconf(_SC_PAGESIZE);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = mapping_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_segv);
+  }
+  struct mapping *m = NULL;
+  for (int i = 0; i < 32 && m == NULL; i++) {
+    if (mappings[i].addr == NULL) m = &mappings[i];
+  }
+  if (m == NULL) {
+    return NULL;
+  }
+  m->num_pages = (length + page_size - 1)/page_size;
+  m->pages = calloc(m->num_pages, 1);
+  void *addr = mmap(NULL, m->num_pages*page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m->pages == NULL || addr == MAP_FAILED) {
+    free(m->pages);
+    return NULL;
+  }
+  m->addr = addr;
+  m->volume = vol;
+  m->offset = offset;
+  m->length = length;
+  m->inode_index = vol->file_descriptor_table[fileID].fd_inode_index;
+  return addr;
+}
+
+// writes the dirty pages of mapping m back to its file, clipped to the mapping and the end
+// of the file, and makes them clean again
+// returns 0 on success, -1 if the volume ran out of space
+int write_back_mapping(struct mapping *m) {
+  struct inode head;
+  int result = 0;
+  read_inode(m->inode_index, &head);
+  for (int page = 0; page < m->num_pages; page++) {
+    if (m->pages[page] != PAGE_DIRTY) continue;
+    int start = m->offset + page*page_size;
+    int length = page_size;
+    if (length > m->length - page*page_size) length = m->length - page*page_size;
+    if (length > INODE_SIZE(head.size) - start) length = INODE_SIZE(head.size) - start;
+    if (length > 0) {
+      if (write_at(m->inode_index, start, m->addr + page*page_size, length) < 0) {
+        result = -1;
+        continue; // stays dirty
+      }
+      for (int i = 0; i < 32; i++) { // written like ssfs_fwrite does, so it gets compressed on close
+        if (vol->file_descriptor_table[i].written == 1 && vol->file_descriptor_table[i].fd_inode_index == m->inode_index) {
+          vol->file_descriptor_table[i].modified = 1;
         }
-        break;
       }
     }
+    mprotect(m->addr + page*page_size, page_size, PROT_READ);
+    m->pages[page] = PAGE_CLEAN;
+  }
+  flush_checksums();
+  return result;
+}
+
+// unmaps mapping m without writing anything back
+void release_mapping(struct mapping *m) {
+  munmap(m->addr, m->num_pages*page_size);
+  free(m->pages);
+  m->addr = NULL;
+}
+
+// writes back the mappings of the file starting at inode_index, or of every file of the
+// volume if inode_index is -1, and unmaps them too if release is set
+// returns 0 on success, -1 if a dirty page could not be written back
+int sync_mappings(int inode_index, int release) {
+  int result = 0;
+  for (int i = 0; i < 32; i++) {
+    struct mapping *m = &mappings[i];
+    if (m->addr == NULL || m->volume != vol || (inode_index >= 0 && m->inode_index != inode_index)) continue;
+    if (write_back_mapping(m) < 0) result = -1;
+    if (release) release_mapping(m);
+  }
+  return result;
+}
+
+// forgets the clean pages of the file starting at inode_index that cover any of bytes
+// [start, end), after the file changed underneath them; they are read in again when next
+// touched. dirty pages keep what was written to them, and overwrite the file when synced
+void drop_mapped_pages(int inode_index, int start, int end) {
+  for (int i = 0; i < 32; i++) {
+    struct mapping *m = &mappings[i];
+    if (m->addr == NULL || m->volume != vol || m->inode_index != inode_index) continue;
+    for (int page = 0; page < m->num_pages; page++) {
+      int page_start = m->offset + page*page_size;
+      if (m->pages[page] == PAGE_CLEAN && page_start < end && page_start + page_size > start) {
+        mprotect(m->addr + page*page_size, page_size, PROT_NONE);
+        m->pages[page] = PAGE_ABSENT;
+      }
+    }
+  }
+}
 
-    if (remove_inode(inode_to_remove) < 0) {
-      return -1;
+// writes the dirty pages of the mapping starting at addr back to the file
+// returns 0 on success, -1 on failure
+int ssfs_msync(void *addr) {
+  for (int i = 0; i < 32; i++) {
+    if (addr != NULL && mappings[i].addr == addr) {
+      vol = mappings[i].volume;
+      return write_back_mapping(&mappings[i]);
     }
   }
   return -1;
 }
+
+// writes back and unmaps the mapping starting at addr
+// returns 0 on success, -1 on failure
+int ssfs_munmap(void *addr) {
+  for (int i = 0; i < 32; i++) {
+    if (addr != NULL && mappings[i].addr == addr) {
+      vol = mappings[i].volume;
+      int result = write_back_mapping(&mappings[i]);
+      release_mapping(&mappings[i]);
+      return result;
+    }
+  }
+  return -1;
+}
+
+// writes back the inode and root directory blocks a batch changed, each once, and ends the batch
+void flush_metadata() {
+  for (int i = 0; i < ROOT_DIR_BLOCK - 1; i++) {
+    if (vol->inode_blocks_dirty & (1 << i)) {
+      write_checked(i + 1, 1, &vol->inode_table[i*INODES_PER_BLOCK]);
+    }
+  }
+  int entries_per_block = SFS_BLOCK_SIZE/16;
+  for (int i = 0; i < 4; i++) {
+    if (vol->root_blocks_dirty & (1 << i)) {
+      write_checked(ROOT_DIR_BLOCK + i, 1, vol->root_directory[i*entries_per_block]);
+    }
+  }
+  vol->inode_blocks_dirty = 0;
+  vol->root_blocks_dirty = 0;
+  vol->batching = 0;
+}
+
+// creates every file in names (plain names or paths) that does not exist yet, without
+// opening them. lookups run against the inode table and root directory in memory, and each
+// inode and root directory block the batch changes is written once at the end, so creating
+// many files costs a few block writes in all rather than a few per file
+// returns number of names that name a file afterwards: count unless a path was invalid or
+// the volume ran out of inodes or blocks, which stops the batch
+int ssfs_vcreate_many(int volume, char **names, int count) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_names("create_many", names, count);
+  if (count < 0) {
+    return -1;
+  }
+  vol->batching = 1;
+  int done = 0;
+  for (; done < count; done++) {
+    int parent;
+    char leaf[DIR_NAME_LENGTH];
+    int inode_index = walk_path(names[done], &parent, leaf);
+    if (inode_index == -2 || (inode_index > 0 && is_directory(inode_index))) break;
+    if (inode_index < 0 && create_entry(parent, leaf, 0) < 0) break;
+  }
+  flush_metadata();
+  flush_checksums();
+  return done;
+}
+
+int ssfs_create_many(char **names, int count) {
+  return ssfs_vcreate_many(0, names, count);
+}
+
+// looks up every name in names, putting the size of each file (or directory) in sizes, and
+// -1 for names that do not exist; warm names cost no disk reads
+// returns number of names found
+int ssfs_vstat_many(int volume, char **names, int count, int *sizes) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_names("stat_many", names, count);
+  int found = 0;
+  for (int i = 0; i < count; i++) {
+    int inode_index = find_path(names[i]);
+    sizes[i] = -1;
+    if (inode_index > 0) {
+      struct inode head;
+      read_inode(inode_index, &head);
+      sizes[i] = INODE_SIZE(head.size);
+      found++;
+    }
+  }
+  return found;
+}
+
+int ssfs_stat_many(char **names, int count, int *sizes) {
+  return ssfs_vstat_many(0, names, count, sizes);
+}
+
+// removes every file and empty directory in names, closing any fds open on them
+// all the freed blocks go back with a single fbm write, and each changed inode and root
+// directory block is written once
+// returns number of names removed
+int ssfs_vremove_many(int volume, char **names, int count) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_names("remove_many", names, count);
+  int removed = 0;
+  vol->batching = 1;
+  for (int i = 0; i < count; i++) {
+    int parent;
+    char leaf[DIR_NAME_LENGTH];
+    int inode_index = walk_path(names[i], &parent, leaf);
+    if (inode_index <= 0 || (is_directory(inode_index) && !dir_is_empty(inode_index))) continue;
+    for (int j = 0; j < 32; j++) {
+      if (vol->file_descriptor_table[j].written == 1 && vol->file_descriptor_table[j].fd_inode_index == inode_index) {
+        ssfs_fclose(volume*32 + j);
+      }
+    }
+    remove_entry(parent, leaf);
+    struct inode node;
+    for (int chained = inode_index; chained > 0; chained = node.indirect) {
+      vol->root_blocks_dirty |= 1 << (chained/(SFS_BLOCK_SIZE/16)); // free_chain clears their names
+      read_inode(chained, &node);
+    }
+    free_chain(inode_index);
+    removed++;
+  }
+  if (removed > 0) {
+    write_checked(FBM_BLOCK, 1, &vol->fbm);
+  }
+  flush_metadata();
+  flush_checksums();
+  return removed;
+}
+
+int ssfs_remove_many(char **names, int count) {
+  return ssfs_vremove_many(0, names, count);
+}
+
+// makes dst a copy of the file src that shares every data block with it: only inodes are
+// written, whatever the size of the file, and no data space is taken. a shared block is copied
+// by whichever file writes to it first (see inode_write), so the two stay independent
+// returns 0 on success, -1 if src is not a file, dst exists, there are not enough inodes, or
+// a block of src would end up with more pointers than the fbm can count
+int ssfs_vclone(int volume, char *src, char *dst) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_op("clone %s %s", src, dst);
+  int source = find_path(src);
+  int parent;
+  char leaf[DIR_NAME_LENGTH];
+  if (source <= 0 || is_directory(source) || walk_path(dst, &parent, leaf) != -1) {
+    return -1;
+  }
+  sync_mappings(source, 0); // what was written through a mapping of src is part of the copy
+  struct inode node;
+  int chain_length = 0;
+  int gained[SFS_NUM_BLOCKS]; // pointers each block gains: after dedup a block can recur many times in src
+  memset(gained, 0, sizeof(gained));
+  for (int i = source; i > 0; i = node.indirect) {
+    read_inode(i, &node);
+    chain_length++;
+    for (int j = 0; j < DIRECT_POINTERS; j++) {
+      int block = POINTER_BLOCK(node.direct[j]);
+      if (block != 0 && block_refs(block) + ++gained[block] > MAX_BLOCK_REFS) return -1;
+    }
+  }
+  if (chain_length + 1 > count_null_inodes()) { // one more in case dst needs the long names directory
+    return -1;
+  }
+
+  vol->batching = 1;
+  int copy_index = create_entry(parent, leaf, 0);
+  if (copy_index < 0) {
+    flush_metadata();
+    flush_checksums();
+    return -1;
+  }
+  for (int source_index = source; source_index > 0; source_index = node.indirect) {
+    read_inode(source_index, &node);
+    struct inode copy = node;
+    for (int j = 0; j < DIRECT_POINTERS; j++) {
+      if (POINTER_BLOCK(copy.direct[j]) != 0 && add_block_ref(POINTER_BLOCK(copy.direct[j])) < 0) {
+        copy.direct[j] = 0; // cannot happen after the check above, but never share a block uncounted
+      }
+    }
+    copy.indirect = 0;
+    if (node.indirect > 0) {
+      copy.indirect = get_null_inode();
+      update_root_directory(copy.indirect, ANON_INODE_NAME);
+    }
+    write_inode(copy_index, &copy);
+    copy_index = copy.indirect;
+  }
+  write_checked(FBM_BLOCK, 1, &vol->fbm);
+  vol->fbm_dirty = 0;
+  flush_metadata();
+  flush_checksums();
+  return 0;
+}
+
+int ssfs_clone(char *src, char *dst) {
+  return ssfs_vclone(0, src, dst);
+}
+
+// removes the file, or empty directory, at path
+// returns 0 on success (or if there is nothing at path), -1 on failure
+int ssfs_vremove(int volume, char *file) {
+  if (use_volume(volume) < 0) {
+    return -1;
+  }
+  trace_op("remove %s", file);
+  int parent;
+  char leaf[DIR_NAME_LENGTH];
+  int inode_to_remove = walk_path(file, &parent, leaf);
+  if (inode_to_remove == -1) return 0;
+  if (inode_to_remove < 0) return -1;
+  if (is_directory(inode_to_remove) && !dir_is_empty(inode_to_remove)) {
+    return -1;
+  }
+
+  for (int i = 0; i < 32; i++) { // must remove from fdt
+    if (vol->file_descriptor_table[i].fd_inode_index == inode_to_remove) {
+      if (ssfs_fclose(volume*32 + i) < 0) {
+        vol->file_descriptor_table[i].written = 0;
+      }
+      break;
+    }
+  }
+
+  remove_entry(parent, leaf);
+  return remove_inode(inode_to_remove);
+}
+
+int ssfs_remove(char *file) {
+  return ssfs_vremove(0, file);
+}
@@ -10,3 +10,44 @@ int ssfs_fread(int fileID, char *buf, int length);
 int ssfs_remove(char *file);
 int ssfs_commit();
 int ssfs_restore(int cnum);
+int ssfs_unmount();
+int ssfs_fallocate(int fileID, int offset, int length);
+int ssfs_ftruncate(int fileID, int size);
+int ssfs_punch_hole(int fileID, int offset, int length);
+int ssfs_getnextfilename(char *fname);
+int ssfs_frag_score(char *name);
+int ssfs_defrag(char *name);
+int ssfs_defrag_all();
+int ssfs_verify();
+int ssfs_set_compression(int on);
+int ssfs_set_dedup(int on);
+void *ssfs_mmap(int fileID, int offset, int length);
+int ssfs_msync(void *addr);
+int ssfs_munmap(void *addr);
+int ssfs_mkdir(char *path);
+int ssfs_create_many(char **names, int count);
+int ssfs_stat_many(char **names, int count, int *sizes);
+int ssfs_remove_many(char **names, int count);
+int ssfs_clone(char *src, char *dst);
+
+// several volumes can be mounted at once: ssfs_mount returns a handle for the image at path,
+// and the ssfs_v* calls below do what the calls without the v do on volume 0, the one mkssfs
+// mounts. fds and mappings carry their volume, so the calls on them work on any volume
+#define SSFS_MOUNT_FRESH 1 // ssfs_mount option: format the image instead of using what is there
+int ssfs_mount(char *path, int opts);
+int ssfs_vunmount(int volume);
+int ssfs_vcommit(int volume);
+int ssfs_vfopen(int volume, char *name);
+int ssfs_vremove(int volume, char *file);
+int ssfs_vmkdir(int volume, char *path);
+int ssfs_vgetnextfilename(int volume, char *fname);
+int ssfs_vfrag_score(int volume, char *name);
+int ssfs_vdefrag(int volume, char *name);
+int ssfs_vdefrag_all(int volume);
+int ssfs_vverify(int volume);
+int ssfs_vset_compression(int volume, int on);
+int ssfs_vset_dedup(int volume, int on);
+int ssfs_vcreate_many(int volume, char **names, int count);
+int ssfs_vstat_many(int volume, char **names, int count, int *sizes);
+int ssfs_vremove_many(int volume, char **names, int count);
+int ssfs_vclone(int volume, char *src, char *dst);
@@ -0,0 +1,366 @@
+// Throughput/latency benchmarks for the SFS, run against a fresh "testsys" volume
+// Every workload reports ops/s, MB/s, p50/p99 latency per op and emulated disk blocks
+// read/written per op. Results can be saved as CSV and compared against an older run.
+//
+// usage: sfs_bench [-o results.csv] [-c baseline.csv] [-t tolerance_percent]
+//   -o  write the results as CSV (one line per workload and I/O size)
+//   -c  compare ops/s against a CSV from an earlier build; exits 1 if any workload is
+//       slower than the baseline by more than the tolerance (default 10%)
+// Build with make bench.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sfs_api.h"
+#include "disk_emu.h"
+
+#define MAX_OPS 20000
+#define FILE_BYTES (512*1024) // size of the file used by the sequential/random workloads
+#define MAX_FILES 150 // files used by the metadata workloads; the volume has 199 inodes
+#define MAX_RESULTS 64
+
+struct result {
+  char workload[32];
+  int io_size;
+  int ops;
+  double seconds;
+  double ops_per_s;
+  double mb_per_s;
+  double p50_us;
+  double p99_us;
+  double blocks_read_per_op;
+  double blocks_written_per_op;
+};
+
+static struct result results[MAX_RESULTS];
+static int num_results = 0;
+
+static double latencies[MAX_OPS];
+static int num_ops;
+static long bytes_moved;
+static long start_read, start_written;
+static struct timespec run_start;
+static char io_buffer[FILE_BYTES];
+
+double now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e6 + t.tv_nsec/1e3;
+}
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(double*)a, y = *(double*)b;
+  return (x > y) - (x < y);
+}
+
+// starts timing a workload
+void begin_run() {
+  num_ops = 0;
+  bytes_moved = 0;
+  start_read = disk_blocks_read;
+  start_written = disk_blocks_written;
+  clock_gettime(CLOCK_MONOTONIC, &run_start);
+}
+
+// records one op that took from op_start until now and moved bytes of file data
+void record_op(double op_start, int bytes) {
+  if (num_ops < MAX_OPS) latencies[num_ops++] = now_us() - op_start;
+  bytes_moved += bytes;
+}
+
+// stops timing a workload and stores its result
+void end_run(char *workload, int io_size) {
+  struct timespec run_end;
+  clock_gettime(CLOCK_MONOTONIC, &run_end);
+  struct result *r = &results[num_results++];
+  strncpy(r->workload, workload, sizeof(r->workload) - 1);
+  r->io_size = io_size;
+  r->ops = num_ops;
+  r->seconds = (run_end.tv_sec - run_start.tv_sec) + (run_end.tv_nsec - run_start.tv_nsec)/1e9;
+  r->ops_per_s = num_ops/r->seconds;
+  r->mb_per_s = bytes_moved/r->seconds/(1024*1024);
+  qsort(latencies, num_ops, sizeof(double), compare_doubles);
+  r->p50_us = num_ops ? latencies[num_ops/2] : 0;
+  r->p99_us = num_ops ? latencies[(num_ops*99)/100] : 0;
+  r->blocks_read_per_op = num_ops ? (double)(disk_blocks_read - start_read)/num_ops : 0;
+  r->blocks_written_per_op = num_ops ? (double)(disk_blocks_written - start_written)/num_ops : 0;
+  printf("%-14s %6d %7d %10.0f %8.2f %9.1f %9.1f %8.2f %8.2f\n", r->workload, r->io_size, r->ops,
+         r->ops_per_s, r->mb_per_s, r->p50_us, r->p99_us, r->blocks_read_per_op, r->blocks_written_per_op);
+}
+
+// sequential and random reads/writes of one file at a given I/O size
+void bench_file_io(int io_size) {
+  int ops = FILE_BYTES/io_size;
+  if (ops > MAX_OPS) ops = MAX_OPS;
+  mkssfs(1);
+  int fd = ssfs_fopen("bench.dat");
+
+  begin_run();
+  for (int i = 0; i < ops; i++) {
+    double op_start = now_us();
+    ssfs_fwrite(fd, io_buffer, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("seq_write", io_size);
+
+  begin_run();
+  ssfs_frseek(fd, 0);
+  for (int i = 0; i < ops; i++) {
+    double op_start = now_us();
+    ssfs_fread(fd, io_buffer, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("seq_read", io_size);
+
+  int file_size = ops*io_size;
+  begin_run();
+  for (int i = 0; i < ops; i++) {
+    ssfs_fwseek(fd, rand()%(file_size - io_size + 1));
+    double op_start = now_us();
+    ssfs_fwrite(fd, io_buffer, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("rand_write", io_size);
+
+  begin_run();
+  for (int i = 0; i < ops; i++) {
+    ssfs_frseek(fd, rand()%(file_size - io_size + 1));
+    double op_start = now_us();
+    ssfs_fread(fd, io_buffer, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("rand_read", io_size);
+
+  // the same random reads, copied out of a mapping of the file instead
+  char *mapped = ssfs_mmap(fd, 0, file_size);
+  begin_run();
+  for (int i = 0; i < ops; i++) {
+    int offset = rand()%(file_size - io_size + 1);
+    double op_start = now_us();
+    memcpy(io_buffer, mapped + offset, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("mmap_rand_read", io_size);
+  ssfs_munmap(mapped);
+  ssfs_unmount();
+}
+
+// create, reopen and remove rates for empty files
+void bench_metadata() {
+  char names[MAX_FILES][16];
+  int fds[MAX_FILES];
+  mkssfs(1);
+
+  begin_run();
+  for (int i = 0; i < MAX_FILES; i++) {
+    sprintf(names[i], "f%05d", i);
+    double op_start = now_us();
+    fds[i] = ssfs_fopen(names[i]);
+    ssfs_fclose(fds[i]);
+    record_op(op_start, 0);
+  }
+  end_run("create", 0);
+
+  begin_run();
+  for (int i = 0; i < MAX_FILES; i++) {
+    double op_start = now_us();
+    fds[i] = ssfs_fopen(names[i]);
+    ssfs_fclose(fds[i]);
+    record_op(op_start, 0);
+  }
+  end_run("open", 0);
+
+  begin_run();
+  for (int i = 0; i < MAX_FILES; i++) {
+    double op_start = now_us();
+    ssfs_remove(names[i]);
+    record_op(op_start, 0);
+  }
+  end_run("remove", 0);
+  ssfs_unmount();
+}
+
+// the create, stat and remove rates of the batched metadata calls, for the same files
+// one call handles every file, so every op is given the average time per file
+void bench_metadata_batched() {
+  char names[MAX_FILES][16];
+  char *name_list[MAX_FILES];
+  int sizes[MAX_FILES];
+  mkssfs(1);
+  for (int i = 0; i < MAX_FILES; i++) {
+    sprintf(names[i], "f%05d", i);
+    name_list[i] = names[i];
+  }
+
+  char *workloads[3] = {"create_many", "stat_many", "remove_many"};
+  for (int w = 0; w < 3; w++) {
+    begin_run();
+    double op_start = now_us();
+    if (w == 0) ssfs_create_many(name_list, MAX_FILES);
+    else if (w == 1) ssfs_stat_many(name_list, MAX_FILES, sizes);
+    else ssfs_remove_many(name_list, MAX_FILES);
+    double per_file = (now_us() - op_start)/MAX_FILES;
+    for (num_ops = 0; num_ops < MAX_FILES; num_ops++) {
+      latencies[num_ops] = per_file;
+    }
+    end_run(workloads[w], 0);
+  }
+  ssfs_unmount();
+}
+
+// many small files written then read back whole: one op is a whole file
+void bench_small_files() {
+  char names[MAX_FILES][16];
+  int sizes[MAX_FILES];
+  mkssfs(1);
+
+  begin_run();
+  for (int i = 0; i < MAX_FILES; i++) {
+    sprintf(names[i], "s%05d", i);
+    sizes[i] = 256 + rand()%4096;
+    double op_start = now_us();
+    int fd = ssfs_fopen(names[i]);
+    ssfs_fwrite(fd, io_buffer, sizes[i]);
+    ssfs_fclose(fd);
+    record_op(op_start, sizes[i]);
+  }
+  end_run("small_write", 0);
+
+  begin_run();
+  for (int i = 0; i < MAX_FILES; i++) {
+    double op_start = now_us();
+    int fd = ssfs_fopen(names[i]);
+    ssfs_fread(fd, io_buffer, sizes[i]);
+    ssfs_fclose(fd);
+    record_op(op_start, sizes[i]);
+  }
+  end_run("small_read", 0);
+  ssfs_unmount();
+}
+
+// two large files grown in interleaved 16 KiB appends, then read back sequentially
+// interleaving scatters their blocks, so this is the workload defragmentation helps
+void bench_large_files() {
+  int io_size = 16*1024;
+  int per_file = (FILE_BYTES/2)/io_size;
+  mkssfs(1);
+  int fds[2] = {ssfs_fopen("large0"), ssfs_fopen("large1")};
+
+  begin_run();
+  for (int i = 0; i < per_file*2; i++) {
+    double op_start = now_us();
+    ssfs_fwrite(fds[i%2], io_buffer, io_size);
+    record_op(op_start, io_size);
+  }
+  end_run("large_write", io_size);
+
+  begin_run();
+  for (int f = 0; f < 2; f++) {
+    ssfs_frseek(fds[f], 0);
+    for (int i = 0; i < per_file; i++) {
+      double op_start = now_us();
+      ssfs_fread(fds[f], io_buffer, io_size);
+      record_op(op_start, io_size);
+    }
+  }
+  end_run("large_read", io_size);
+  ssfs_unmount();
+}
+
+// 1 KiB writes on a deduplicating volume: first of data not yet on the volume, where every
+// lookup misses and a block is written, then of the same data again into a second file,
+// where every lookup finds the block in use and nothing but metadata is written
+void bench_dedup() {
+  int io_size = 1024;
+  int ops = FILE_BYTES/2/io_size;
+  mkssfs(1);
+  ssfs_set_dedup(1);
+  int fds[2] = {ssfs_fopen("unique"), ssfs_fopen("copy")};
+  char *names[2] = {"dedup_miss", "dedup_hit"};
+
+  for (int f = 0; f < 2; f++) {
+    begin_run();
+    for (int i = 0; i < ops; i++) {
+      double op_start = now_us();
+      ssfs_fwrite(fds[f], io_buffer + i*io_size, io_size);
+      record_op(op_start, io_size);
+    }
+    end_run(names[f], io_size);
+  }
+  ssfs_unmount();
+}
+
+void write_csv(char *path) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    printf("Could not write %s\n", path);
+    return;
+  }
+  fprintf(out, "workload,io_size,ops,seconds,ops_per_s,mb_per_s,p50_us,p99_us,blocks_read_per_op,blocks_written_per_op\n");
+  for (int i = 0; i < num_results; i++) {
+    struct result *r = &results[i];
+    fprintf(out, "%s,%d,%d,%.6f,%.1f,%.3f,%.2f,%.2f,%.3f,%.3f\n", r->workload, r->io_size, r->ops, r->seconds,
+            r->ops_per_s, r->mb_per_s, r->p50_us, r->p99_us, r->blocks_read_per_op, r->blocks_written_per_op);
+  }
+  fclose(out);
+}
+
+// compares ops/s with a baseline CSV
+// returns number of workloads slower than the baseline by more than tolerance percent
+int compare_csv(char *path, double tolerance) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    printf("Could not read %s\n", path);
+    return 0;
+  }
+  char line[256];
+  int regressions = 0;
+  printf("\ncompared to %s:\n", path);
+  fgets(line, sizeof(line), in); // header
+  while (fgets(line, sizeof(line), in)) {
+    char workload[32];
+    int io_size;
+    double old_ops_per_s;
+    if (sscanf(line, "%31[^,],%d,%*d,%*f,%lf", workload, &io_size, &old_ops_per_s) != 3) continue;
+    for (int i = 0; i < num_results; i++) {
+      if (strcmp(results[i].workload, workload) != 0 || results[i].io_size != io_size) continue;
+      double change = (results[i].ops_per_s - old_ops_per_s)/old_ops_per_s*100;
+      int regressed = change < -tolerance;
+      printf("%-14s %6d %+7.1f%%%s\n", workload, io_size, change, regressed ? "  REGRESSION" : "");
+      regressions += regressed;
+    }
+  }
+  fclose(in);
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  char *csv_out = NULL, *csv_baseline = NULL;
+  double tolerance = 10;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-o") == 0) csv_out = argv[i+1];
+    else if (strcmp(argv[i], "-c") == 0) csv_baseline = argv[i+1];
+    else if (strcmp(argv[i], "-t") == 0) tolerance = atof(argv[i+1]);
+  }
+  srand(310);
+  for (int i = 0; i < FILE_BYTES; i++) {
+    io_buffer[i] = 'a' + rand()%26;
+  }
+
+  printf("%-14s %6s %7s %10s %8s %9s %9s %8s %8s\n", "workload", "io", "ops", "ops/s", "MB/s", "p50(us)", "p99(us)", "rd/op", "wr/op");
+  int io_sizes[] = {64, 1024, 4096, 16384};
+  for (int i = 0; i < 4; i++) {
+    bench_file_io(io_sizes[i]);
+  }
+  bench_metadata();
+  bench_metadata_batched();
+  bench_small_files();
+  bench_large_files();
+  bench_dedup();
+
+  if (csv_out != NULL) write_csv(csv_out);
+  if (csv_baseline != NULL && compare_csv(csv_baseline, tolerance) > 0) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+// Offline defragmenter for an existing SFS volume ("testsys" in the current directory).
+// Prints the fragmentation score of every file, compacts the volume and prints the
+// scores again. Build with make defrag.
+#include <stdio.h>
+#include "sfs_api.h"
+
+// prints the fragmentation score of every file in the volume
+// returns number of files that are not contiguous
+int print_scores() {
+  char name[16];
+  int fragmented = 0;
+  while (ssfs_getnextfilename(name)) {
+    int score = ssfs_frag_score(name);
+    printf("%-16s %3d%%\n", name, score);
+    if (score > 0) fragmented++;
+  }
+  return fragmented;
+}
+
+int main(int argc, char **argv) {
+  mkssfs(0);
+  printf("before:\n");
+  int fragmented = print_scores();
+  if (fragmented == 0) {
+    printf("volume is not fragmented\n");
+    return 0;
+  }
+  int moved = ssfs_defrag_all();
+  if (moved < 0) {
+    printf("some files could not be compacted\nafter:\n");
+  } else {
+    printf("moved %d blocks\nafter:\n", moved);
+  }
+  print_scores();
+  return 0;
+}
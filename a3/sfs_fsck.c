@@ -0,0 +1,421 @@
+// Offline checker for SFS images, built on the on-disk structures in sfs_layout.h
+// Rebuilds the fbm the image should have from the blocks referenced by every file's inode
+// chain and compares it to the stored one, and checks that (anonIN) chains are well formed.
+// A block may be shared by several pointers (dedup, clones) if the fbm counts every one of
+// them; a block named more often than its fbm byte says is cross-linked.
+// On volumes with a checksum table, every block in use is also checked against its crc32c.
+// Directories are walked from the top level: every entry must name the head inode of a nested
+// file no other entry names, and every nested file must be named by an entry.
+// Chains are walked by several threads at once; each file is owned by one thread and
+// blocks/inodes are claimed with atomic operations, so cross-links show up wherever they are.
+//
+// usage: sfs_fsck [-r] [-m] [-j threads] [image]
+//   -r  repair: rebuild the fbm, drop bad pointers, cut bad chains, release orphaned
+//       (anonIN) inodes and give every file its own copy of cross-linked blocks; shared
+//       blocks whose count is merely off keep being shared with the right count. bad
+//       directory entries are cleared and nested files no entry names are released
+//   -m  print the extent map of every file
+//   -j  number of scanning threads (default: one per online cpu)
+// image defaults to testsys in the current directory
+// exit status: 0 if the image is consistent, 1 if problems were repaired, 4 if problems remain
+// (blocks failing their checksum cannot be repaired)
+// Build with make fsck.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "sfs_layout.h"
+#include "crc32c.h"
+
+#define MAX_REPORT 4096 // bytes of extent map kept per file
+
+// what the scan found out about one file, written only by the thread that owns the file
+struct file_report {
+  int chain_length; // inodes in the chain, head included
+  int blocks; // allocated data blocks
+  int bad_pointers; // direct pointers outside the data area
+  int bad_link; // inode whose indirect pointer is invalid, or -1
+  char map[MAX_REPORT];
+  int map_length;
+};
+
+static struct superblock super;
+static struct inode inodes[NUM_INODES + INODES_PER_BLOCK];
+static char names[256][16];
+static struct block fbm;
+static unsigned int checksums[SFS_NUM_BLOCKS];
+static int has_checksums = 0;
+static int data_end = FBM_BLOCK; // data blocks are [FIRST_DATA_BLOCK, data_end)
+
+static struct file_report reports[NUM_INODES];
+static int inode_owner[NUM_INODES]; // head inode of the chain an inode was reached from, or -1
+static int block_refs[SFS_NUM_BLOCKS]; // number of pointers to each block
+static char shared[SFS_NUM_BLOCKS]; // blocks the fbm records as shared, so more pointers are no cross-link
+static char named[NUM_INODES]; // nested head inodes named by a directory entry
+
+static int num_threads;
+static int print_maps = 0;
+
+// true if a direct pointer is neither a hole nor a block of the data area
+int bad_pointer(int pointer) {
+  int block = POINTER_BLOCK(pointer);
+  return (pointer & ~POINTER_COMPRESSED) != block || (block != 0 && (block < FIRST_DATA_BLOCK || block >= data_end));
+}
+
+// true if inode i heads a file: it has a name that is not the chained-inode marker
+int is_file(int i) {
+  return i > 0 && names[i][0] != 0 && strcmp(names[i], ANON_INODE_NAME) != 0;
+}
+
+// appends to a file's extent map, dropping output once the report is full
+void map_append(struct file_report *report, const char *format, int a, int b, int c, int d) {
+  if (!print_maps || report->map_length >= MAX_REPORT - 64) return;
+  report->map_length += snprintf(report->map + report->map_length, MAX_REPORT - report->map_length, format, a, b, c, d);
+}
+
+// closes the run of file blocks [run_start, file_block) at disk block run_disk
+// (0 for a hole, -1 for compressed extents)
+void map_flush(struct file_report *report, int run_start, int file_block, int run_disk) {
+  if (run_start >= file_block) return;
+  if (run_disk == 0) {
+    map_append(report, "  [%d-%d] hole\n", run_start, file_block - 1, 0, 0);
+  } else if (run_disk < 0) {
+    map_append(report, "  [%d-%d] compressed\n", run_start, file_block - 1, 0, 0);
+  } else {
+    map_append(report, "  [%d-%d] -> %d-%d\n", run_start, file_block - 1, run_disk, run_disk + file_block - run_start - 1);
+  }
+}
+
+// walks the chain of the file headed by head, claiming its inodes and counting its blocks
+void scan_file(int head) {
+  struct file_report *report = &reports[head];
+  report->bad_link = -1;
+  int inode_index = head;
+  int previous = -1;
+  int chain_no = 0;
+  int run_start = 0, run_disk = 0; // current extent, for the map
+
+  while (inode_index > 0) {
+    if (inode_index >= NUM_INODES || (inode_index != head && strcmp(names[inode_index], ANON_INODE_NAME) != 0)) {
+      report->bad_link = previous; // chain leaves the table or runs into another file
+      break;
+    }
+    int unowned = -1;
+    if (!__atomic_compare_exchange_n(&inode_owner[inode_index], &unowned, head, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      report->bad_link = previous; // cycle, or two chains sharing an inode
+      break;
+    }
+    report->chain_length++;
+    struct inode *node = &inodes[inode_index];
+    for (int j = 0; j < DIRECT_POINTERS; j++) {
+      int file_block = chain_no*DIRECT_POINTERS + j;
+      int pointer = POINTER_BLOCK(node->direct[j]);
+      if (bad_pointer(node->direct[j])) {
+        report->bad_pointers++;
+        pointer = 0;
+      }
+      if (pointer != 0) {
+        __atomic_fetch_add(&block_refs[pointer], 1, __ATOMIC_RELAXED);
+        report->blocks++;
+      }
+      int disk = node->direct[j] & POINTER_COMPRESSED ? -1 : pointer; // where the map places the block
+      int continues = (disk <= 0 && disk == run_disk) || (run_disk > 0 && disk == run_disk + file_block - run_start);
+      if (!continues) {
+        map_flush(report, run_start, file_block, run_disk);
+        run_start = file_block;
+        run_disk = disk;
+      }
+    }
+    previous = inode_index;
+    inode_index = node->indirect;
+    chain_no++;
+  }
+  int end_block = chain_no*DIRECT_POINTERS; // slots past the end of the file are not worth listing
+  int size_blocks = (INODE_SIZE(inodes[head].size) + SFS_BLOCK_SIZE - 1)/SFS_BLOCK_SIZE;
+  if (run_disk == 0 && size_blocks < end_block) end_block = size_blocks;
+  map_flush(report, run_start, end_block, run_disk);
+}
+
+// thread body: scans every num_threads-th file starting from *first
+void *scan_thread(void *first) {
+  for (int i = *(int*)first; i < NUM_INODES; i += num_threads) {
+    if (is_file(i)) scan_file(i);
+  }
+  return NULL;
+}
+
+// walks every directory reachable from the top level, marking the nested files its entries
+// name; an entry naming an inode that is not the head of a nested file, or that an earlier
+// entry already names, is reported, and cleared if clear is set. a block is only rewritten if
+// no other file shares it and, on volumes with checksums, it still passes its checksum
+// returns number of bad entries
+int check_directories(int fd, int clear) {
+  int queue[NUM_INODES];
+  int queued = 0;
+  for (int i = 1; i < NUM_INODES; i++) {
+    if (!is_file(i) || strcmp(names[i], NESTED_INODE_NAME) == 0) continue;
+    if (inodes[i].size & SIZE_DIRECTORY || strcmp(names[i], LONG_NAMES_NAME) == 0) queue[queued++] = i;
+  }
+  int bad = 0;
+  struct dir_entry entries[SFS_BLOCK_SIZE/sizeof(struct dir_entry)];
+  for (int q = 0; q < queued; q++) { // a directory is queued once, when its entry is found
+    int directory = queue[q];
+    int remaining = INODE_SIZE(inodes[directory].size);
+    for (int inode_index = directory; inode_index > 0 && inode_owner[inode_index] == directory; inode_index = inodes[inode_index].indirect) {
+      for (int j = 0; j < DIRECT_POINTERS && remaining > 0; j++, remaining -= SFS_BLOCK_SIZE) {
+        int pointer = inodes[inode_index].direct[j];
+        if (pointer == 0 || bad_pointer(pointer) || pointer & POINTER_COMPRESSED) continue; // directories are never compressed
+        pread(fd, entries, SFS_BLOCK_SIZE, (off_t)pointer*SFS_BLOCK_SIZE);
+        int intact = !has_checksums || crc32c(entries, SFS_BLOCK_SIZE) == checksums[pointer];
+        int count = remaining < SFS_BLOCK_SIZE ? remaining/(int)sizeof(struct dir_entry) : SFS_BLOCK_SIZE/(int)sizeof(struct dir_entry);
+        int cleared = 0;
+        for (int e = 0; e < count; e++) {
+          int entry = entries[e].inode;
+          if (entry == 0) continue;
+          if (entry > 0 && entry < NUM_INODES && !named[entry] && strcmp(names[entry], NESTED_INODE_NAME) == 0) {
+            named[entry] = 1;
+            if (inodes[entry].size & SIZE_DIRECTORY) queue[queued++] = entry;
+            continue;
+          }
+          entries[e].name[DIR_NAME_LENGTH - 1] = '\0';
+          printf("directory %d: entry %s names inode %d, which is no unnamed nested file\n", directory, entries[e].name, entry);
+          bad++;
+          if (clear && intact && block_refs[pointer] == 1) {
+            memset(&entries[e], 0, sizeof(entries[e]));
+            cleared = 1;
+          }
+        }
+        if (cleared) {
+          pwrite(fd, entries, SFS_BLOCK_SIZE, (off_t)pointer*SFS_BLOCK_SIZE);
+          checksums[pointer] = crc32c(entries, SFS_BLOCK_SIZE);
+        }
+      }
+    }
+  }
+  return bad;
+}
+
+// gives up the nested file headed by head, whose chain then counts as orphaned (anonIN) inodes
+// that are released with the others, its blocks no longer referenced
+void drop_file(int head) {
+  for (int inode_index = head; inode_index > 0 && inode_owner[inode_index] == head; inode_index = inodes[inode_index].indirect) {
+    for (int j = 0; j < DIRECT_POINTERS; j++) {
+      if (!bad_pointer(inodes[inode_index].direct[j]) && POINTER_BLOCK(inodes[inode_index].direct[j]) != 0) {
+        block_refs[POINTER_BLOCK(inodes[inode_index].direct[j])]--;
+      }
+    }
+    inode_owner[inode_index] = -1;
+    strcpy(names[inode_index], ANON_INODE_NAME);
+  }
+}
+
+// gives every pointer to a cross-linked block but the first its own copy of the block
+// returns number of blocks copied, or -1 if the volume ran out of free blocks
+int split_cross_links(int fd, unsigned char *expected) {
+  int copied = 0;
+  int seen[SFS_NUM_BLOCKS];
+  memset(seen, 0, sizeof(seen));
+  for (int i = 1; i < NUM_INODES; i++) {
+    if (!is_file(i)) continue;
+    for (int inode_index = i; inode_index > 0 && inode_owner[inode_index] == i; inode_index = inodes[inode_index].indirect) {
+      for (int j = 0; j < DIRECT_POINTERS; j++) {
+        int pointer = POINTER_BLOCK(inodes[inode_index].direct[j]);
+        if (pointer < FIRST_DATA_BLOCK || pointer >= data_end || block_refs[pointer] < 2 || shared[pointer]) continue;
+        if (!seen[pointer]++) continue; // first reference keeps the original
+        int copy = FIRST_DATA_BLOCK;
+        while (copy < data_end && expected[copy] != 1) copy++;
+        if (copy == data_end) return -1;
+        struct block data;
+        pread(fd, &data, SFS_BLOCK_SIZE, (off_t)pointer*SFS_BLOCK_SIZE);
+        pwrite(fd, &data, SFS_BLOCK_SIZE, (off_t)copy*SFS_BLOCK_SIZE);
+        expected[copy] = 0;
+        checksums[copy] = checksums[pointer];
+        inodes[inode_index].direct[j] = (inodes[inode_index].direct[j] & POINTER_COMPRESSED) | copy;
+        copied++;
+      }
+    }
+  }
+  return copied;
+}
+
+int main(int argc, char **argv) {
+  char *image = FSNAME;
+  int repair = 0;
+  num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0) repair = 1;
+    else if (strcmp(argv[i], "-m") == 0) print_maps = 1;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) num_threads = atoi(argv[++i]);
+    else image = argv[i];
+  }
+  if (num_threads < 1) num_threads = 1;
+  if (num_threads > NUM_INODES) num_threads = NUM_INODES;
+
+  int fd = open(image, repair ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    printf("Could not open %s\n", image);
+    return 4;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // metadata is small and contiguous: one read each for the inode table, root dir and fbm
+  pread(fd, &super, sizeof(super), 0);
+  if (super.magic_number != SFS_MAGIC || super.super_block_size != SFS_BLOCK_SIZE || super.super_num_blocks != SFS_NUM_BLOCKS) {
+    printf("%s: not an SFS image (bad super block)\n", image);
+    return 4;
+  }
+  pread(fd, inodes, (ROOT_DIR_BLOCK - 1)*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE);
+  pread(fd, names, 4*SFS_BLOCK_SIZE, (off_t)ROOT_DIR_BLOCK*SFS_BLOCK_SIZE);
+  pread(fd, &fbm, SFS_BLOCK_SIZE, (off_t)FBM_BLOCK*SFS_BLOCK_SIZE);
+  if (super.checksums == SFS_CHECKSUM_MAGIC) {
+    has_checksums = 1;
+    data_end = CHECKSUM_BLOCK;
+    pread(fd, checksums, CHECKSUM_BLOCKS*SFS_BLOCK_SIZE, (off_t)CHECKSUM_BLOCK*SFS_BLOCK_SIZE);
+  }
+  for (int i = 0; i < NUM_INODES; i++) {
+    names[i][15] = '\0';
+    inode_owner[i] = -1;
+  }
+
+  pthread_t threads[num_threads];
+  int firsts[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    firsts[t] = t;
+    pthread_create(&threads[t], NULL, scan_thread, &firsts[t]);
+  }
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  int problems = 0;
+  int files = 0, used = 0;
+  problems += check_directories(fd, repair);
+  int unnamed = 0;
+  for (int i = 1; i < NUM_INODES; i++) {
+    if (strcmp(names[i], NESTED_INODE_NAME) == 0 && !named[i]) {
+      unnamed++;
+      if (repair) drop_file(i);
+    }
+  }
+  if (unnamed > 0) {
+    printf("%d nested files not named by any directory entry\n", unnamed);
+    problems++;
+  }
+  for (int i = 1; i < NUM_INODES; i++) {
+    if (!is_file(i)) continue;
+    struct file_report *report = &reports[i];
+    files++;
+    if (print_maps) {
+      printf("%s (inode %d, %d bytes, %d inodes, %d blocks)%s\n%s", names[i], i, INODE_SIZE(inodes[i].size), report->chain_length,
+             report->blocks, inodes[i].size & SIZE_DIRECTORY ? " directory" : "", report->map);
+    }
+    if (report->bad_pointers > 0) {
+      printf("%s: %d block pointers outside the data area\n", names[i], report->bad_pointers);
+      problems++;
+    }
+    if (report->bad_link >= 0) {
+      printf("%s: chain broken after inode %d (indirect %d)\n", names[i], report->bad_link, inodes[report->bad_link].indirect);
+      problems++;
+    }
+  }
+
+  int orphans = 0;
+  for (int i = 1; i < NUM_INODES; i++) {
+    if (strcmp(names[i], ANON_INODE_NAME) == 0 && inode_owner[i] < 0) {
+      orphans++;
+    }
+  }
+  if (orphans > 0) {
+    printf("%d chained inodes not reached from any file\n", orphans);
+    problems++;
+  }
+
+  unsigned char expected[SFS_NUM_BLOCKS];
+  int leaked = 0, lost = 0, miscounted = 0, cross_linked = 0;
+  for (int b = FIRST_DATA_BLOCK; b < FBM_BLOCK; b++) {
+    shared[b] = fbm.bytes[b] >= 2 && block_refs[b] <= MAX_BLOCK_REFS;
+    expected[b] = block_refs[b] > 0 || b >= data_end ? 0 : 1; // the checksum table is reserved
+    if (block_refs[b] > 1 && shared[b]) expected[b] = block_refs[b];
+    if (expected[b] != 1 && b < data_end) used++;
+    if (block_refs[b] > 1 && !shared[b]) {
+      printf("block %d is referenced %d times\n", b, block_refs[b]);
+      cross_linked++;
+    }
+    if (expected[b] == 1 && fbm.bytes[b] != 1) leaked++;
+    else if (expected[b] != 1 && fbm.bytes[b] == 1) lost++;
+    else if (expected[b] != fbm.bytes[b]) miscounted++;
+  }
+  if (leaked > 0) printf("%d blocks marked used but referenced by no file\n", leaked);
+  if (lost > 0) printf("%d blocks in use but marked free\n", lost);
+  if (miscounted > 0) printf("%d shared blocks with a wrong reference count\n", miscounted);
+  problems += (leaked > 0) + (lost > 0) + (miscounted > 0) + cross_linked;
+
+  int corrupt = 0;
+  if (has_checksums) { // metadata and every referenced block; the table does not cover itself
+    struct block *blocks = malloc(SFS_NUM_BLOCKS*sizeof(struct block));
+    pread(fd, blocks, SFS_NUM_BLOCKS*SFS_BLOCK_SIZE, 0);
+    for (int b = 0; b < SFS_NUM_BLOCKS; b++) {
+      if (b >= FIRST_DATA_BLOCK && b < FBM_BLOCK && block_refs[b] == 0) continue;
+      if (crc32c(&blocks[b], SFS_BLOCK_SIZE) != checksums[b]) {
+        printf("block %d fails its checksum\n", b);
+        problems++;
+        if (b >= FIRST_DATA_BLOCK && b < FBM_BLOCK) corrupt++; // metadata is rewritten by a repair
+      }
+    }
+    free(blocks);
+  }
+
+  int status = problems > 0 ? 4 : 0;
+  if (repair && problems > corrupt) {
+    struct inode empty_inode;
+    memset(&empty_inode, 0, sizeof(empty_inode));
+    for (int i = 1; i < NUM_INODES; i++) {
+      if (is_file(i) && reports[i].bad_link >= 0) {
+        inodes[reports[i].bad_link].indirect = 0;
+      }
+      if (inode_owner[i] >= 0) {
+        for (int j = 0; j < DIRECT_POINTERS; j++) {
+          if (bad_pointer(inodes[i].direct[j])) inodes[i].direct[j] = 0;
+        }
+      } else if (strcmp(names[i], ANON_INODE_NAME) == 0) {
+        inodes[i] = empty_inode;
+        memset(names[i], 0, 16);
+      }
+    }
+    int copied = cross_linked > 0 ? split_cross_links(fd, expected) : 0;
+    if (copied < 0) {
+      printf("not enough free blocks to separate cross-linked files\n");
+    } else {
+      memcpy(fbm.bytes + FIRST_DATA_BLOCK, expected + FIRST_DATA_BLOCK, FBM_BLOCK - FIRST_DATA_BLOCK);
+      pwrite(fd, inodes, (ROOT_DIR_BLOCK - 1)*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE);
+      pwrite(fd, names, 4*SFS_BLOCK_SIZE, (off_t)ROOT_DIR_BLOCK*SFS_BLOCK_SIZE);
+      pwrite(fd, &fbm, SFS_BLOCK_SIZE, (off_t)FBM_BLOCK*SFS_BLOCK_SIZE);
+      super.clean = 1; // consistent again, the next mount can skip its own scan
+      pwrite(fd, &super, sizeof(super), 0);
+      if (has_checksums) { // only the metadata written here is re-checksummed, bad data stays bad
+        checksums[0] = crc32c(&super, SFS_BLOCK_SIZE);
+        for (int b = 1; b < ROOT_DIR_BLOCK; b++) {
+          checksums[b] = crc32c((char*)inodes + (b - 1)*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE);
+        }
+        for (int b = 0; b < 4; b++) {
+          checksums[ROOT_DIR_BLOCK + b] = crc32c((char*)names + b*SFS_BLOCK_SIZE, SFS_BLOCK_SIZE);
+        }
+        checksums[FBM_BLOCK] = crc32c(&fbm, SFS_BLOCK_SIZE);
+        pwrite(fd, checksums, CHECKSUM_BLOCKS*SFS_BLOCK_SIZE, (off_t)CHECKSUM_BLOCK*SFS_BLOCK_SIZE);
+      }
+      printf("repaired (%d cross-linked blocks copied)\n", copied);
+      status = corrupt > 0 ? 4 : 1;
+    }
+  }
+  close(fd);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6;
+  printf("%s: %d files, %d/%d data blocks used, %d problems, %d threads, %.2f ms\n",
+         image, files, used, data_end - FIRST_DATA_BLOCK, problems, num_threads, elapsed);
+  return status;
+}
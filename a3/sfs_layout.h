@@ -0,0 +1,84 @@
+// On-disk layout of the SFS, shared by sfs_api.c and the offline tools
+// 0th block is super, 1st-13th are inodes, 14-17th are root dir, 1023rd is fbm
+// fbm holds one byte per block: 1 if the block is free, 0 if one pointer names it, and n
+// (2 to 255) if n pointers share it, as deduplicated and cloned blocks are shared
+// volumes with checksums keep a crc32c of every block in 1019th-1022nd, reserved in the fbm
+#ifndef SFS_LAYOUT_H
+#define SFS_LAYOUT_H
+
+#define FSNAME "testsys"
+#define SFS_MAGIC 0xACBD0005
+#define SFS_BLOCK_SIZE 1024
+#define SFS_NUM_BLOCKS 1024
+#define DIRECT_POINTERS 14 // direct block pointers per inode
+#define INODES_PER_BLOCK 16
+#define NUM_INODES 200 // one per root directory entry
+#define ROOT_DIR_BLOCK 14 // root directory takes 4 blocks from here
+#define FIRST_DATA_BLOCK 18 // blocks before this hold the super block, inodes and root dir
+#define FBM_BLOCK 1023
+#define CHECKSUM_BLOCK 1019 // checksum table takes 4 blocks from here, 256 checksums per block
+#define CHECKSUM_BLOCKS 4
+#define SFS_CHECKSUM_MAGIC 0xC5C32C01 // super block checksums field of volumes with a checksum table
+#define SFS_COMPRESSION_MAGIC 0x4C5A0001 // super block compression field of volumes that compress
+#define SFS_DEDUP_MAGIC 0xDD0B0001 // super block dedup field of volumes that share identical blocks
+#define MAX_BLOCK_REFS 255 // most pointers an fbm byte can count for one block
+#define ANON_INODE_NAME "(anonIN)" // root directory name of the inodes chained after a file's first
+
+// directories are files of dir_entry records, 16 per block, whose head inode has SIZE_DIRECTORY
+// set in its size. top-level names of up to 15 bytes are kept in the root directory as before;
+// longer top-level names are entries of the directory named LONG_NAMES_NAME in the root
+// directory, and the head inodes of files reached through a directory are named
+// NESTED_INODE_NAME there, which keeps the root directory the record of every inode in use
+#define SIZE_DIRECTORY 0x40000000
+#define INODE_SIZE(size) ((size) & ~SIZE_DIRECTORY) // bytes in a file or directory
+#define DIR_NAME_LENGTH 60 // bytes of a directory entry's name, terminator included
+#define NESTED_INODE_NAME "(nested)"
+#define LONG_NAMES_NAME "(longnames)"
+
+// an inode's direct pointers form two extents of 7, which are compressed as a unit
+// every allocated slot of a compressed extent is flagged POINTER_COMPRESSED; the first of
+// them hold, in order, the blocks of the compressed stream (an int length, then the
+// lz-compressed data of the flagged slots in slot order), and the rest hold no block
+#define EXTENT_BLOCKS 7
+#define POINTER_COMPRESSED 0x40000000
+#define POINTER_BLOCK(pointer) ((pointer) & 0xFFFF) // block number of a direct pointer, 0 if none
+
+// useful for assembling reads/writes
+// must be packed in order that padding doesn't cause data to be lost
+struct __attribute__((__packed__)) block {
+  unsigned char bytes[1024];
+};
+
+// 1 inode per file, 64 bytes each (16 inodes per block)
+// a file that needs more than 14 blocks continues in the inode named by indirect
+// a direct pointer of 0 is a hole, as block 0 is the super block
+// must be packed in order that padding doesn't cause data to be lost
+struct __attribute__((__packed__)) inode {
+  int size;
+  int direct[14];
+  int indirect;
+};
+
+// one name in a directory; an entry with inode 0 is free
+// must be packed in order that padding doesn't cause data to be lost
+struct __attribute__((__packed__)) dir_entry {
+  int inode;
+  char name[DIR_NAME_LENGTH];
+};
+
+// stored at beginning of file system; takes one block
+// must be packed in order that padding doesn't cause data to be lost
+// volumes made before checksums have arbitrary bytes after clean, hence the magic value
+struct __attribute__((__packed__)) superblock {
+  int magic_number;
+  int super_block_size;
+  int super_num_blocks;
+  struct inode jnode;
+  int clean; // 1 while unmounted after ssfs_unmount; 0 while mounted or after a crash
+  unsigned int checksums; // SFS_CHECKSUM_MAGIC if the volume has a checksum table
+  unsigned int compression; // SFS_COMPRESSION_MAGIC if written files get compressed when closed
+  unsigned int dedup; // SFS_DEDUP_MAGIC if written blocks are shared with identical blocks in use
+  unsigned char reserved[1024 - 92]; // pads the super block to a whole block
+};
+
+#endif
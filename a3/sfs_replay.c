@@ -0,0 +1,304 @@
+// Replays a recorded trace of ssfs_* calls and reports throughput and per-op latency
+// Traces are recorded by running any program linked with sfs_api.c with SFS_TRACE=<file>
+// set in the environment; each line is "<time in us> <pid> <op> <args>". The batch calls
+// list their names after their count; mmap, defrag, verify and the volume settings are not
+// recorded, so a trace of a program using them replays without them.
+//
+// usage: sfs_replay [-t] [-p] [-i image] trace
+//   -t  keep the original gaps between ops (default: replay at full speed)
+//   -p  replay every process recorded in the trace in its own process, all at once;
+//       by default the whole trace is replayed in order by a single process
+//   -i  volume to start from; every replaying process works on its own copy, as SFS
+//       volumes cannot be shared between processes. without -i, every replaying
+//       process starts from a freshly formatted volume
+// Build with make replay.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sfs_api.h"
+
+#define MAX_STREAMS 64
+#define MAX_IO (1 << 20)
+
+enum op_type { OP_MKFS, OP_OPEN, OP_CLOSE, OP_RSEEK, OP_WSEEK, OP_READ, OP_WRITE, OP_REMOVE,
+               OP_COMMIT, OP_TRUNCATE, OP_UNMOUNT, OP_FALLOCATE, OP_PUNCH, OP_MKDIR, OP_CLONE,
+               OP_CREATE_MANY, OP_STAT_MANY, OP_REMOVE_MANY, NUM_OP_TYPES };
+static char *op_names[NUM_OP_TYPES] = {"mkfs", "open", "close", "rseek", "wseek", "read", "write",
+                                       "remove", "commit", "truncate", "unmount", "fallocate", "punch",
+                                       "mkdir", "clone", "create_many", "stat_many", "remove_many"};
+
+struct op {
+  long time_us;
+  int stream; // index of the recorded process
+  int type;
+  char *name; // path of open, remove and mkdir, source of clone
+  char *target; // destination of clone
+  char **names; // the a names of a batch call
+  int a, b, c;
+};
+
+// latency of one replayed op, sent from the replaying process to the parent
+struct sample {
+  int type;
+  float latency_us;
+};
+
+static struct op *ops;
+static int num_ops = 0;
+static int stream_pids[MAX_STREAMS];
+static int num_streams = 0;
+static char io_buffer[MAX_IO];
+
+double now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e6 + t.tv_nsec/1e3;
+}
+
+// reads the trace into ops
+// returns 0 on success, -1 on failure
+int load_trace(char *path) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    printf("Could not open trace %s\n", path);
+    return -1;
+  }
+  int capacity = 1024;
+  ops = malloc(capacity*sizeof(struct op));
+  char *line = NULL; // batch calls make lines of any length
+  size_t line_capacity = 0;
+  char op_name[16];
+  while (getline(&line, &line_capacity, in) > 0) {
+    struct op op;
+    int pid, args;
+    memset(&op, 0, sizeof(op));
+    if (sscanf(line, "%ld %d %15s %n", &op.time_us, &pid, op_name, &args) != 3) continue;
+    for (op.type = 0; op.type < NUM_OP_TYPES && strcmp(op_names[op.type], op_name) != 0; op.type++);
+    if (op.type == NUM_OP_TYPES) continue;
+    char *arg = strtok(line + args, " \n");
+    if (op.type == OP_OPEN || op.type == OP_REMOVE || op.type == OP_MKDIR || op.type == OP_CLONE) {
+      if (arg == NULL) continue;
+      op.name = strdup(arg);
+      arg = strtok(NULL, " \n");
+      if (op.type == OP_OPEN && arg != NULL) op.a = atoi(arg);
+      if (op.type == OP_CLONE) op.target = strdup(arg != NULL ? arg : "");
+    } else if (op.type == OP_CREATE_MANY || op.type == OP_STAT_MANY || op.type == OP_REMOVE_MANY) {
+      op.a = arg != NULL ? atoi(arg) : 0;
+      op.names = malloc((op.a + 1)*sizeof(char*));
+      int found = 0;
+      while (found < op.a && (arg = strtok(NULL, " \n")) != NULL) op.names[found++] = strdup(arg);
+      op.a = found;
+    } else {
+      sscanf(line, "%*d %*d %*s %d %d %d", &op.a, &op.b, &op.c);
+    }
+
+    for (op.stream = 0; op.stream < num_streams && stream_pids[op.stream] != pid; op.stream++);
+    if (op.stream == num_streams) {
+      if (num_streams == MAX_STREAMS) continue;
+      stream_pids[num_streams++] = pid;
+    }
+    if (num_ops == capacity) {
+      capacity *= 2;
+      ops = realloc(ops, capacity*sizeof(struct op));
+    }
+    ops[num_ops++] = op;
+  }
+  free(line);
+  fclose(in);
+  return 0;
+}
+
+// copies the file at from to to
+// returns 0 on success, -1 on failure
+int copy_file(char *from, char *to) {
+  FILE *in = fopen(from, "rb");
+  FILE *out = fopen(to, "wb");
+  if (in == NULL || out == NULL) {
+    if (in) fclose(in);
+    if (out) fclose(out);
+    return -1;
+  }
+  size_t n;
+  while ((n = fread(io_buffer, 1, MAX_IO, in)) > 0) {
+    fwrite(io_buffer, 1, n, out);
+  }
+  fclose(in);
+  fclose(out);
+  return 0;
+}
+
+// replays the ops of stream (or of every stream if stream is -1) in a scratch directory,
+// then writes the latency samples to out
+void replay(int stream, char *image, int timed, int out) {
+  char dir[] = "sfs_replay.XXXXXX";
+  char here[1024];
+  getcwd(here, sizeof(here));
+  if (mkdtemp(dir) == NULL || chdir(dir) < 0) {
+    printf("Could not create a scratch directory\n");
+    exit(1);
+  }
+  char image_path[1100];
+  if (image != NULL) {
+    snprintf(image_path, sizeof(image_path), "%s/%s", image[0] == '/' ? "" : here, image);
+    if (copy_file(image_path, "testsys") < 0) {
+      printf("Could not copy %s\n", image);
+      rmdir(dir);
+      exit(1);
+    }
+  } else { // formatting outside the timed replay, so that a first "mkfs 0" finds a volume
+    mkssfs(1);
+    ssfs_unmount();
+  }
+
+  int fd_map[MAX_STREAMS][32]; // recorded fd of each stream -> fd in this process
+  memset(fd_map, -1, sizeof(fd_map));
+  int mounted = 0;
+  int max_names = 1;
+  for (int i = 0; i < num_ops; i++) {
+    if (ops[i].a > max_names && ops[i].names != NULL) max_names = ops[i].a;
+  }
+  int *sizes = malloc(max_names*sizeof(int)); // for stat_many
+  struct sample *samples = malloc(num_ops*sizeof(struct sample));
+  int num_samples = 0;
+  long first_time = -1;
+  double start = now_us();
+
+  for (int i = 0; i < num_ops; i++) {
+    struct op *op = &ops[i];
+    if (stream >= 0 && op->stream != stream) continue;
+    if (first_time < 0) first_time = op->time_us;
+    if (timed) { // waiting until the op is as far into the replay as it was into the trace
+      double wait = (op->time_us - first_time) - (now_us() - start);
+      if (wait > 0) usleep(wait);
+    }
+    if (!mounted && op->type != OP_MKFS) {
+      mkssfs(0);
+    }
+    mounted = op->type != OP_UNMOUNT;
+    int fd = (op->a >= 0 && op->a < 32) ? fd_map[op->stream][op->a] : -1;
+    int length = op->b < MAX_IO ? op->b : MAX_IO;
+
+    double op_start = now_us();
+    switch (op->type) {
+      case OP_MKFS: mkssfs(op->a); break;
+      case OP_OPEN: fd = ssfs_fopen(op->name); break;
+      case OP_CLOSE: ssfs_fclose(fd); break;
+      case OP_RSEEK: ssfs_frseek(fd, op->b); break;
+      case OP_WSEEK: ssfs_fwseek(fd, op->b); break;
+      case OP_READ: ssfs_fread(fd, io_buffer, length); break;
+      case OP_WRITE: ssfs_fwrite(fd, io_buffer, length); break;
+      case OP_REMOVE: ssfs_remove(op->name); break;
+      case OP_COMMIT: ssfs_commit(); break;
+      case OP_TRUNCATE: ssfs_ftruncate(fd, op->b); break;
+      case OP_UNMOUNT: ssfs_unmount(); break;
+      case OP_FALLOCATE: ssfs_fallocate(fd, op->b, op->c); break;
+      case OP_PUNCH: ssfs_punch_hole(fd, op->b, op->c); break;
+      case OP_MKDIR: ssfs_mkdir(op->name); break;
+      case OP_CLONE: ssfs_clone(op->name, op->target); break;
+      case OP_CREATE_MANY: ssfs_create_many(op->names, op->a); break;
+      case OP_STAT_MANY: ssfs_stat_many(op->names, op->a, sizes); break;
+      case OP_REMOVE_MANY: ssfs_remove_many(op->names, op->a); break;
+    }
+    samples[num_samples].type = op->type;
+    samples[num_samples++].latency_us = now_us() - op_start;
+    if (op->type == OP_OPEN && op->a >= 0 && op->a < 32) {
+      fd_map[op->stream][op->a] = fd;
+    }
+  }
+  if (mounted) ssfs_unmount();
+  double elapsed = now_us() - start;
+
+  chdir(here);
+  char scratch_image[64];
+  snprintf(scratch_image, sizeof(scratch_image), "%s/testsys", dir);
+  remove(scratch_image);
+  rmdir(dir);
+
+  write(out, &elapsed, sizeof(elapsed));
+  write(out, &num_samples, sizeof(num_samples));
+  write(out, samples, num_samples*sizeof(struct sample));
+  free(samples);
+  free(sizes);
+}
+
+int compare_floats(const void *a, const void *b) {
+  float x = *(float*)a, y = *(float*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int timed = 0, parallel = 0;
+  char *image = NULL, *trace = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0) timed = 1;
+    else if (strcmp(argv[i], "-p") == 0) parallel = 1;
+    else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) image = argv[++i];
+    else trace = argv[i];
+  }
+  if (trace == NULL) {
+    printf("usage: sfs_replay [-t] [-p] [-i image] trace\n");
+    return 1;
+  }
+  if (load_trace(trace) < 0) return 1;
+  memset(io_buffer, 'r', MAX_IO);
+
+  int workers = parallel ? num_streams : 1;
+  int pipes[MAX_STREAMS];
+  for (int w = 0; w < workers; w++) {
+    int fds[2];
+    pipe(fds);
+    if (fork() == 0) {
+      close(fds[0]);
+      replay(parallel ? w : -1, image, timed, fds[1]);
+      exit(0);
+    }
+    close(fds[1]);
+    pipes[w] = fds[0];
+  }
+
+  // collecting every process's samples, grouped by op type
+  float *latencies[NUM_OP_TYPES];
+  int counts[NUM_OP_TYPES];
+  for (int t = 0; t < NUM_OP_TYPES; t++) {
+    latencies[t] = malloc((num_ops + 1)*sizeof(float));
+    counts[t] = 0;
+  }
+  double longest = 0;
+  int total = 0;
+  for (int w = 0; w < workers; w++) {
+    FILE *in = fdopen(pipes[w], "rb");
+    double elapsed;
+    int num_samples;
+    if (fread(&elapsed, sizeof(elapsed), 1, in) != 1 || fread(&num_samples, sizeof(num_samples), 1, in) != 1) {
+      printf("replay process %d failed\n", w);
+      fclose(in);
+      continue;
+    }
+    if (elapsed > longest) longest = elapsed;
+    struct sample sample;
+    for (int i = 0; i < num_samples && fread(&sample, sizeof(sample), 1, in) == 1; i++) {
+      latencies[sample.type][counts[sample.type]++] = sample.latency_us;
+      total++;
+    }
+    fclose(in);
+  }
+  while (wait(NULL) > 0);
+
+  printf("%d ops from %d recorded processes replayed by %d processes in %.1f ms: %.0f ops/s\n",
+         total, num_streams, workers, longest/1e3, total/(longest/1e6));
+  printf("%-11s %8s %10s %10s %10s %10s %10s\n", "op", "count", "mean(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+  for (int t = 0; t < NUM_OP_TYPES; t++) {
+    int n = counts[t];
+    if (n == 0) continue;
+    qsort(latencies[t], n, sizeof(float), compare_floats);
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += latencies[t][i];
+    printf("%-11s %8d %10.1f %10.1f %10.1f %10.1f %10.1f\n", op_names[t], n, sum/n,
+           latencies[t][n/2], latencies[t][(n*9)/10], latencies[t][(n*99)/100], latencies[t][n - 1]);
+    free(latencies[t]);
+  }
+  return 0;
+}
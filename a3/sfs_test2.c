@@ -80,6 +80,18 @@ int difficult_test(){
   test_close_files(file_names, file_id, num_file, &err_no);
   test_remove_files(file_id, file_size, write_ptr, file_names, write_buf, num_file, &err_no);
   //So at this point, there should be no files live.
+  //Features beyond the assignment, each tested on an image of its own
+  test_clone_after_dedup(&err_no);
+  test_multiple_volumes(&err_no);
+  test_checksums(&err_no);
+  test_mmap(&err_no);
+  test_nested_directories(&err_no);
+  test_sparse_files(&err_no);
+  test_truncate_and_holes(&err_no);
+  test_defrag(&err_no);
+  test_compression(&err_no);
+  test_dedup(&err_no);
+  test_batch_calls(&err_no);
   //final round
   printf("\n-------------------------------\nDifficult test Finished.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
   free_name_element(file_names, num_file);
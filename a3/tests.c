@@ -733,3 +733,818 @@ int free_name_element(char **name_list, int num_file){
     free(name_list[i]);
   return 0;
 }
+
+/*
+Checks a volume the way a feature test leaves it: every block in use must pass its checksum,
+and once unmounted, sfs_fsck (built along with make test2) must find the image consistent.
+*/
+int test_check_image(int volume, char *image, int *err_no){
+  int res = ssfs_vverify(volume);
+  if(res != 0){
+    fprintf(stderr, "Error: ssfs_vverify returned %d on %s\n", res, image);
+    *err_no += 1;
+  }
+  if(ssfs_vunmount(volume) < 0){
+    fprintf(stderr, "Error: ssfs_vunmount failed on %s\n", image);
+    *err_no += 1;
+  }
+  if(fsck_image("", image) > 0){
+    fprintf(stderr, "Error: sfs_fsck found problems in %s\n", image);
+    *err_no += 1;
+  }
+  return 0;
+}
+
+/*
+Runs sfs_fsck with options on an unmounted image.
+Returns its exit status (0 consistent, 1 repaired, 4 problems left), or -1 if it is not built.
+*/
+int fsck_image(char *options, char *image){
+  if(access("./sfs_fsck", X_OK) != 0){
+    fprintf(stderr, "Warning: sfs_fsck not built, %s is not checked\n", image);
+    return -1;
+  }
+  char command[128];
+  snprintf(command, sizeof(command), "./sfs_fsck -j 2 %s %s > /dev/null", options, image);
+  int res = system(command);
+  return WIFEXITED(res) ? WEXITSTATUS(res) : 4;
+}
+
+/*
+Reads length bytes at offset of a file and compares them with expected.
+*/
+int test_read_back(int file_id, int offset, char *expected, int length, int *err_no){
+  char *buf = calloc(length + 1, sizeof(char));
+  ssfs_frseek(file_id, offset);
+  int res = ssfs_fread(file_id, buf, length);
+  if(res != length || memcmp(buf, expected, length) != 0){
+    fprintf(stderr, "Error: read back of %d bytes at %d failed (read %d)\n", length, offset, res);
+    *err_no += 1;
+  }
+  free(buf);
+  return 0;
+}
+
+/*
+Clones files whose blocks dedup merged into one, so each clone adds many pointers to a single block.
+Removing the source must leave the clone readable with every block counted right, and a clone
+that would give a block more pointers than the fbm can count (255) must be refused.
+*/
+int test_clone_after_dedup(int *err_no){
+  char *image = "clone.img";
+  char *data = calloc(200*1024, sizeof(char));
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  if(volume < 0){
+    fprintf(stderr, "Error: could not mount %s\n", image);
+    *err_no += 1;
+    free(data);
+    return 0;
+  }
+  ssfs_vset_dedup(volume, 1);
+  //100 identical blocks: cloning brings the block to 200 pointers, which fits
+  memset(data, 's', 100*1024);
+  int file_id = ssfs_vfopen(volume, "small");
+  for(int i = 0; i < 100; i++)
+    ssfs_fwrite(file_id, data, 1024);
+  ssfs_fclose(file_id);
+  if(ssfs_vclone(volume, "small", "small.copy") < 0){
+    fprintf(stderr, "Error: ssfs_vclone of a 100 block file failed\n");
+    *err_no += 1;
+  }
+  ssfs_vremove(volume, "small");
+  //200 identical blocks: a clone would need 400 pointers to one block
+  memset(data, 'b', 200*1024);
+  file_id = ssfs_vfopen(volume, "big");
+  for(int i = 0; i < 200; i++)
+    ssfs_fwrite(file_id, data, 1024);
+  ssfs_fclose(file_id);
+  if(ssfs_vclone(volume, "big", "big.copy") >= 0){
+    fprintf(stderr, "Error: ssfs_vclone shared a block more often than the fbm can count\n");
+    *err_no += 1;
+  }
+  test_check_image(volume, image, err_no);
+
+  volume = ssfs_mount(image, 0);
+  int sizes[2];
+  char *names[2] = {"small.copy", "big.copy"};
+  ssfs_vstat_many(volume, names, 2, sizes);
+  if(sizes[0] != 100*1024 || sizes[1] != -1){
+    fprintf(stderr, "Error: after cloning, small.copy has %d bytes and big.copy %d\n", sizes[0], sizes[1]);
+    *err_no += 1;
+  }
+  memset(data, 's', 100*1024);
+  file_id = ssfs_vfopen(volume, "small.copy");
+  test_read_back(file_id, 0, data, 100*1024, err_no);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  free(data);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Mounts two images at once and checks their files stay apart, then checks that an fd kept past
+an unmount fails instead of writing into the next image mounted in the same slot.
+*/
+int test_multiple_volumes(int *err_no){
+  char *images[2] = {"volume_a.img", "volume_b.img"};
+  char *text[2] = {"written to the first volume", "written to the second volume"};
+  int volume[2], file_id[2];
+  for(int i = 0; i < 2; i++){
+    volume[i] = ssfs_mount(images[i], SSFS_MOUNT_FRESH);
+    file_id[i] = ssfs_vfopen(volume[i], "shared.txt");
+    if(volume[i] < 0 || file_id[i] < 0){
+      fprintf(stderr, "Error: could not mount %s and open a file on it\n", images[i]);
+      *err_no += 1;
+      return 0;
+    }
+  }
+  for(int i = 0; i < 2; i++)
+    ssfs_fwrite(file_id[i], text[i], strlen(text[i]));
+  for(int i = 0; i < 2; i++)
+    test_read_back(file_id[i], 0, text[i], strlen(text[i]), err_no);
+  //file_id[0] stays open across the unmount, and must fail both before and after its slot is reused
+  test_check_image(volume[0], images[0], err_no);
+  test_check_image(volume[1], images[1], err_no);
+  char buf[16];
+  for(int i = 0; i < 2; i++){
+    if(ssfs_fwrite(file_id[0], "stale", 5) >= 0 || ssfs_fread(file_id[0], buf, 5) >= 0 || ssfs_fwseek(file_id[0], 0) >= 0
+       || ssfs_ftruncate(file_id[0], 0) >= 0 || ssfs_punch_hole(file_id[0], 0, 5) >= 0){
+      fprintf(stderr, "Error: an fd of an unmounted volume still works\n");
+      *err_no += 1;
+    }
+    if(i == 0 && ssfs_mount(images[1], 0) != volume[0]){
+      fprintf(stderr, "Warning: the remount did not reuse slot %d\n", volume[0]);
+    }
+  }
+  //volume[1] is a stale handle now: calls on it must not reach the image mounted since
+  char *stale_name = "stale";
+  int size;
+  if(ssfs_vmkdir(volume[1], "x") >= 0 || ssfs_vfopen(volume[1], "y") >= 0 || ssfs_vremove(volume[1], "shared.txt") >= 0
+     || ssfs_vclone(volume[1], "shared.txt", "z") >= 0 || ssfs_vstat_many(volume[1], &stale_name, 1, &size) >= 0
+     || ssfs_vgetnextfilename(volume[1], buf) > 0 || ssfs_vfrag_score(volume[1], "shared.txt") >= 0
+     || ssfs_vdefrag(volume[1], "shared.txt") >= 0 || ssfs_vcreate_many(volume[1], &stale_name, 1) >= 0){
+    fprintf(stderr, "Error: a handle of an unmounted volume still works\n");
+    *err_no += 1;
+  }
+  int reopened = ssfs_vfopen(volume[0], "shared.txt");
+  test_read_back(reopened, 0, text[1], strlen(text[1]), err_no);
+  ssfs_fclose(reopened);
+  test_check_image(volume[0], images[1], err_no);
+  volume[0] = ssfs_mount(images[0], 0);
+  file_id[0] = ssfs_vfopen(volume[0], "shared.txt");
+  test_read_back(file_id[0], 0, text[0], strlen(text[0]), err_no);
+  ssfs_fclose(file_id[0]);
+  test_check_image(volume[0], images[0], err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Corrupts a data block behind the file system's back, then checks that reads, truncate, punch_hole
+and defrag all refuse to touch it rather than hand it out or give it a fresh checksum, and that
+overwriting the whole block makes the file good again. A write that fills holes in the head
+inode before reaching a corrupt block in the next chain inode must fail without changing anything.
+*/
+int test_checksums(int *err_no){
+  char *image = "checksum.img";
+  char data[2][4*1024];
+  char *names[2] = {"first", "second"};
+  int file_id[2];
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  for(int i = 0; i < 2; i++){
+    memset(data[i], 'x' + i, sizeof(data[i]));
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+  }
+  //interleaved writes leave both files fragmented, first in blocks 0, 2, 4 and 6 of the data area
+  for(int block = 0; block < 4; block++)
+    for(int i = 0; i < 2; i++)
+      ssfs_fwrite(file_id[i], data[i], 1024);
+  //block 15 of first, in its second chain inode, goes to block 8 of the data area
+  ssfs_fwseek(file_id[0], 15*1024);
+  ssfs_fwrite(file_id[0], data[0], 1024);
+  ssfs_vunmount(volume);
+
+  FILE *disk = fopen(image, "r+b");
+  fseek(disk, (FIRST_DATA_BLOCK + 2)*SFS_BLOCK_SIZE + 100, SEEK_SET);
+  fputc('!', disk);
+  fclose(disk);
+
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 2; i++)
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+  int res = ssfs_vverify(volume);
+  if(res != 1){
+    fprintf(stderr, "Error: ssfs_vverify found %d corrupt blocks instead of 1\n", res);
+    *err_no += 1;
+  }
+  char buf[1024];
+  ssfs_frseek(file_id[0], 1024);
+  if(ssfs_fread(file_id[0], buf, 1024) >= 0){
+    fprintf(stderr, "Error: ssfs_fread handed out a block that fails its checksum\n");
+    *err_no += 1;
+  }
+  if(ssfs_ftruncate(file_id[0], 1500) >= 0 || ssfs_punch_hole(file_id[0], 1100, 200) >= 0 || ssfs_vdefrag(volume, names[0]) >= 0){
+    fprintf(stderr, "Error: truncate, punch_hole or defrag went through a block that fails its checksum\n");
+    *err_no += 1;
+  }
+  res = ssfs_vverify(volume);
+  if(res != 1){
+    fprintf(stderr, "Error: after failed operations, ssfs_vverify found %d corrupt blocks instead of 1\n", res);
+    *err_no += 1;
+  }
+  if(ssfs_vdefrag(volume, names[1]) != 4){
+    fprintf(stderr, "Error: ssfs_vdefrag did not move the 4 blocks of an intact file\n");
+    *err_no += 1;
+  }
+  //a whole block written over the corrupt one needs nothing from it
+  ssfs_fwseek(file_id[0], 1024);
+  ssfs_fwrite(file_id[0], data[0], 1024);
+  for(int i = 0; i < 2; i++)
+    ssfs_fclose(file_id[i]);
+  test_check_image(volume, image, err_no);
+
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 2; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+    ssfs_fclose(file_id[i]);
+  }
+  test_check_image(volume, image, err_no);
+
+  disk = fopen(image, "r+b");
+  fseek(disk, (FIRST_DATA_BLOCK + 8)*SFS_BLOCK_SIZE + 100, SEEK_SET);
+  fputc('!', disk);
+  fclose(disk);
+  volume = ssfs_mount(image, 0);
+  file_id[0] = ssfs_vfopen(volume, names[0]);
+  //blocks 4 to 14 are holes of the head inode, block 15 is only partly written
+  char *fill = calloc(11*1024 + 100, sizeof(char));
+  ssfs_fwseek(file_id[0], 4*1024);
+  if(ssfs_fwrite(file_id[0], fill, 11*1024 + 100) >= 0){
+    fprintf(stderr, "Error: ssfs_fwrite went through a block that fails its checksum\n");
+    *err_no += 1;
+  }
+  free(fill);
+  ssfs_fwseek(file_id[0], 15*1024);
+  ssfs_fwrite(file_id[0], data[0], 1024);
+  test_read_back(file_id[0], 0, data[0], sizeof(data[0]), err_no);
+  ssfs_fclose(file_id[0]);
+  test_check_image(volume, image, err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+static sigjmp_buf fault_jump;
+
+//SIGSEGV handler of the test program itself, standing in for one installed before ssfs_mmap
+static void note_fault(int signal_number, siginfo_t *info, void *context){
+  siglongjmp(fault_jump, 1);
+}
+
+/*
+Maps part of a file, reads and writes it through the pointer and checks the file afterwards.
+A fault outside the mapping must reach the handler the program installed before ssfs_mmap,
+without taking the mappings' handler away. Runs in a child, as the handlers stay installed.
+*/
+int test_mmap(int *err_no){
+  int temp;
+  fflush(stdout); //the child must not print what the parent has buffered
+  int pid = fork();
+  if(pid == 0){
+    int error_num = 0;
+    char *image = "mmap.img";
+    char data[10000];
+    for(int i = 0; i < sizeof(data); i++)
+      data[i] = 'a' + i%26;
+    int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+    int file_id = ssfs_vfopen(volume, "mapped");
+    ssfs_fwrite(file_id, data, sizeof(data));
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = note_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+
+    char *map = ssfs_mmap(file_id, 0, sizeof(data));
+    if(map == NULL || memcmp(map, data, sizeof(data)) != 0){
+      fprintf(stderr, "Error: mapped memory does not hold the file\n");
+      exit(error_num + 1);
+    }
+    map[5000] = '#';
+    data[5000] = '#';
+    char *guard = mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    for(int i = 0; i < 2; i++){
+      if(sigsetjmp(fault_jump, 1) == 0){
+        guard[0] = 1;
+        fprintf(stderr, "Error: writing to a PROT_NONE page did not fault\n");
+        error_num += 1;
+      }
+    }
+    ssfs_msync(map);
+    ssfs_munmap(map);
+    //after faults outside it, a new mapping must still be faulted in by the file system
+    map = ssfs_mmap(file_id, 0, sizeof(data));
+    if(sigsetjmp(fault_jump, 1) == 0){
+      map[9000] = '$';
+      data[9000] = '$';
+      ssfs_munmap(map);
+    }else{
+      fprintf(stderr, "Error: a fault inside a mapping went to the previous handler\n");
+      error_num += 1;
+    }
+    ssfs_fclose(file_id);
+    test_check_image(volume, image, &error_num);
+
+    volume = ssfs_mount(image, 0);
+    file_id = ssfs_vfopen(volume, "mapped");
+    test_read_back(file_id, 0, data, sizeof(data), &error_num);
+    ssfs_fclose(file_id);
+    test_check_image(volume, image, &error_num);
+    exit(error_num);
+  }
+  waitpid(pid, &temp, 0);
+  if(WIFEXITED(temp) == 0){
+    fprintf(stderr, "Error: mmap test died. Error code: %d\n", temp);
+    *err_no += 1;
+  }else{
+    *err_no += WEXITSTATUS(temp);
+  }
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Reads block of an unmounted image, or writes it and keeps its checksum in the table up to date,
+to damage an image the way a crash or a bug would.
+*/
+void image_block(char *image, int block, void *data, int write){
+  FILE *disk = fopen(image, "r+b");
+  fseek(disk, (long)block*SFS_BLOCK_SIZE, SEEK_SET);
+  if(!write){
+    fread(data, SFS_BLOCK_SIZE, 1, disk);
+    fclose(disk);
+    return;
+  }
+  fwrite(data, SFS_BLOCK_SIZE, 1, disk);
+  unsigned int checksum = crc32c(data, SFS_BLOCK_SIZE);
+  fseek(disk, (long)CHECKSUM_BLOCK*SFS_BLOCK_SIZE + block*sizeof(checksum), SEEK_SET);
+  fwrite(&checksum, sizeof(checksum), 1, disk);
+  fclose(disk);
+}
+
+/*
+Builds nested directories and a long top-level name and reads them back after a remount. Then
+damages directory d the way a crash could: the entry of d/lost is zeroed and an entry naming a
+free inode is added, with the volume marked as not cleanly unmounted. sfs_fsck must find both,
+and both its repair and the scan on mount must leave a consistent image with d/kept intact.
+*/
+int test_nested_directories(int *err_no){
+  char *image = "dirs.img";
+  char *copy = "dirs_copy.img";
+  char *paths[5] = {"d/kept", "d/lost", "d/e/deep.txt", "a_top_level_name_too_long_for_the_root_directory", "d/ghost"};
+  char data[3000];
+  memset(data, 'n', sizeof(data));
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  if(ssfs_vmkdir(volume, "d") < 0 || ssfs_vmkdir(volume, "/d/e") < 0 || ssfs_vmkdir(volume, "d/e") >= 0){
+    fprintf(stderr, "Error: ssfs_vmkdir failed\n");
+    *err_no += 1;
+  }
+  for(int i = 0; i < 4; i++){
+    int file_id = ssfs_vfopen(volume, paths[i]);
+    ssfs_fwrite(file_id, data, sizeof(data) - i);
+    ssfs_fclose(file_id);
+  }
+  test_check_image(volume, image, err_no);
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 4; i++){
+    int file_id = ssfs_vfopen(volume, paths[i]);
+    test_read_back(file_id, 0, data, sizeof(data) - i, err_no);
+    ssfs_fclose(file_id);
+  }
+  test_check_image(volume, image, err_no);
+
+  //finding d through the root directory, and its entries through its first block
+  char names[SFS_BLOCK_SIZE/16][16];
+  struct inode inodes[INODES_PER_BLOCK];
+  struct dir_entry entries[SFS_BLOCK_SIZE/sizeof(struct dir_entry)];
+  struct superblock super;
+  int directory = 0;
+  for(int block = 0; block < 4 && directory == 0; block++){
+    image_block(image, ROOT_DIR_BLOCK + block, names, 0);
+    for(int i = 0; i < SFS_BLOCK_SIZE/16; i++)
+      if(strcmp(names[i], "d") == 0)
+        directory = block*(SFS_BLOCK_SIZE/16) + i;
+  }
+  image_block(image, 1 + directory/INODES_PER_BLOCK, inodes, 0);
+  int entry_block = inodes[directory%INODES_PER_BLOCK].direct[0];
+  image_block(image, entry_block, entries, 0);
+  for(int i = 0; i < SFS_BLOCK_SIZE/sizeof(struct dir_entry); i++){
+    if(strcmp(entries[i].name, "lost") == 0){
+      memset(&entries[i], 0, sizeof(entries[i]));
+      entries[i].inode = NUM_INODES - 1; //a free inode, as the volume has few files
+      strcpy(entries[i].name, "ghost");
+    }
+  }
+  image_block(image, entry_block, entries, 1);
+  image_block(image, 0, &super, 0);
+  super.clean = 0;
+  image_block(image, 0, &super, 1);
+
+  char command[128];
+  snprintf(command, sizeof(command), "cp %s %s", image, copy);
+  system(command);
+  int res = fsck_image("", copy);
+  if(res >= 0 && (res != 4 || fsck_image("-r", copy) != 1 || fsck_image("", copy) != 0)){
+    fprintf(stderr, "Error: sfs_fsck did not find and repair the damaged directory\n");
+    *err_no += 1;
+  }
+  remove(copy);
+
+  volume = ssfs_mount(image, 0);
+  int sizes[5];
+  ssfs_vstat_many(volume, paths, 5, sizes);
+  if(sizes[0] != sizeof(data) || sizes[1] != -1 || sizes[4] != -1){
+    fprintf(stderr, "Error: after the scan on mount, d/kept has %d bytes, d/lost %d and d/ghost %d\n", sizes[0], sizes[1], sizes[4]);
+    *err_no += 1;
+  }
+  int file_id = ssfs_vfopen(volume, paths[0]);
+  test_read_back(file_id, 0, data, sizeof(data), err_no);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Counts the data blocks an unmounted image's fbm marks as in use.
+*/
+int used_data_blocks(char *image){
+  struct block fbm;
+  image_block(image, FBM_BLOCK, &fbm, 0);
+  int used = 0;
+  for(int i = FIRST_DATA_BLOCK; i < CHECKSUM_BLOCK; i++)
+    if(fbm.bytes[i] != 1)
+      used++;
+  return used;
+}
+
+/*
+Writes a few bytes far past the end of an empty file. The gap must read as zeroes, before and
+after a remount, without any block being given to it.
+*/
+int test_sparse_files(int *err_no){
+  char *image = "sparse.img";
+  char *text = "the end of a sparse file";
+  int gap = 50*1024 + 500;
+  int length = gap + strlen(text);
+  char *data = calloc(length, sizeof(char));
+  memcpy(data + gap, text, strlen(text));
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  int file_id = ssfs_vfopen(volume, "sparse");
+  if(ssfs_fwseek(file_id, gap) < 0 || ssfs_fwrite(file_id, text, strlen(text)) != strlen(text)){
+    fprintf(stderr, "Error: could not write past the end of a file\n");
+    *err_no += 1;
+  }
+  test_read_back(file_id, 0, data, length, err_no);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  int used = used_data_blocks(image);
+  if(used != 1){
+    fprintf(stderr, "Error: a sparse file with one written block takes %d blocks\n", used);
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  file_id = ssfs_vfopen(volume, "sparse");
+  test_read_back(file_id, 0, data, length, err_no);
+  test_read_back(file_id, gap - 10, data + gap - 10, 20, err_no);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  free(data);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Punches a hole into a file, truncates it, grows it again and preallocates parts of it. Every
+step must read back as expected, and the blocks freed and reserved must add up in the fbm.
+Preallocating part of a clone must give it private copies of the blocks it shares.
+*/
+int test_truncate_and_holes(int *err_no){
+  char *image = "holes.img";
+  char data[10*1024];
+  for(int i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + (i/1024 + i)%26;
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  int file_id = ssfs_vfopen(volume, "holes");
+  ssfs_fwrite(file_id, data, sizeof(data));
+  //blocks 2 to 5 lie wholly inside the hole and are freed, the ends are zeroed in place
+  if(ssfs_punch_hole(file_id, 1500, 5000) < 0){
+    fprintf(stderr, "Error: ssfs_punch_hole failed\n");
+    *err_no += 1;
+  }
+  memset(data + 1500, 0, 5000);
+  test_read_back(file_id, 0, data, sizeof(data), err_no);
+  //shrinking to 8000 frees blocks 8 and 9, and the rest of block 7 must read as zeroes later
+  if(ssfs_ftruncate(file_id, 8000) < 0 || ssfs_ftruncate(file_id, 9000) < 0){
+    fprintf(stderr, "Error: ssfs_ftruncate failed\n");
+    *err_no += 1;
+  }
+  memset(data + 8000, 0, 1000);
+  test_read_back(file_id, 0, data, 9000, err_no);
+  //blocks 2 and 3 come back zeroed, and blocks 8 and 9 along with 1000 more bytes
+  if(ssfs_fallocate(file_id, 2048, 2048) < 0 || ssfs_fallocate(file_id, 9000, 1000) < 0){
+    fprintf(stderr, "Error: ssfs_fallocate failed\n");
+    *err_no += 1;
+  }
+  memset(data + 9000, 0, 1000);
+  test_read_back(file_id, 0, data, 10000, err_no);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  int used = used_data_blocks(image);
+  if(used != 8){
+    fprintf(stderr, "Error: after punch_hole, truncate and fallocate the file takes %d blocks instead of 8\n", used);
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  file_id = ssfs_vfopen(volume, "holes");
+  int size;
+  char *name = "holes";
+  ssfs_vstat_many(volume, &name, 1, &size);
+  if(size != 10000){
+    fprintf(stderr, "Error: file has %d bytes instead of 10000\n", size);
+    *err_no += 1;
+  }
+  test_read_back(file_id, 0, data, 10000, err_no);
+  //the clone shares all 8 blocks until preallocating its first 4 copies them
+  int copy_id = -1;
+  if(ssfs_vclone(volume, "holes", "copy") < 0 || (copy_id = ssfs_vfopen(volume, "copy")) < 0
+     || ssfs_fallocate(copy_id, 0, 4096) < 0){
+    fprintf(stderr, "Error: could not preallocate part of a clone\n");
+    *err_no += 1;
+  }
+  test_read_back(copy_id, 0, data, 10000, err_no);
+  test_read_back(file_id, 0, data, 10000, err_no);
+  ssfs_fclose(copy_id);
+  ssfs_fclose(file_id);
+  test_check_image(volume, image, err_no);
+  used = used_data_blocks(image);
+  if(used != 12){
+    fprintf(stderr, "Error: a clone preallocated over 4 shared blocks leaves %d blocks in use instead of 12\n", used);
+    *err_no += 1;
+  }
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Interleaves the writes of three files, the last of them inside a directory, so that their blocks
+alternate on disk, removes one to leave gaps, and compacts the volume. The other two must come
+out contiguous and unchanged.
+*/
+int test_defrag(int *err_no){
+  char *image = "defrag.img";
+  char *names[3] = {"first", "second", "d/third"};
+  char data[3][20*1024];
+  int file_id[3];
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  ssfs_vmkdir(volume, "d");
+  for(int i = 0; i < 3; i++){
+    for(int j = 0; j < sizeof(data[i]); j++)
+      data[i][j] = 'A' + i + (j/1024)%20;
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+  }
+  for(int block = 0; block < 20; block++)
+    for(int i = 0; i < 3; i++)
+      ssfs_fwrite(file_id[i], data[i] + block*1024, 1024);
+  for(int i = 0; i < 3; i++)
+    ssfs_fclose(file_id[i]);
+  ssfs_vremove(volume, names[1]);
+  if(ssfs_vfrag_score(volume, names[0]) == 0 || ssfs_vfrag_score(volume, names[2]) == 0){
+    fprintf(stderr, "Warning: interleaved writes did not fragment the files\n");
+  }
+  if(ssfs_vdefrag_all(volume) <= 0){
+    fprintf(stderr, "Error: ssfs_vdefrag_all moved no blocks\n");
+    *err_no += 1;
+  }
+  for(int i = 0; i < 3; i += 2){
+    int score = ssfs_vfrag_score(volume, names[i]);
+    if(score != 0){
+      fprintf(stderr, "Error: %s still has a fragmentation score of %d after ssfs_vdefrag_all\n", names[i], score);
+      *err_no += 1;
+    }
+  }
+  test_check_image(volume, image, err_no);
+  if(used_data_blocks(image) != 41){ //20 blocks for each file left and one for the entries of d
+    fprintf(stderr, "Error: defragmenting leaked or lost blocks\n");
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 3; i += 2){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+    ssfs_fclose(file_id[i]);
+  }
+  test_check_image(volume, image, err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Writes a compressible and an incompressible file on a volume that compresses, and overwrites
+part of a compressed extent after a remount. The compressible file must take fewer blocks than
+it has, and both must read back as written. Once the volume is full, a write into a compressed
+extent has no blocks to inflate it into and must fail without changing anything.
+*/
+int test_compression(int *err_no){
+  char *image = "compress.img";
+  char *names[2] = {"text", "noise"};
+  char data[2][20*1024];
+  int file_id[2];
+  for(int j = 0; j < sizeof(data[0]); j++){
+    data[0][j] = test_str[j%strlen(test_str)];
+    data[1][j] = rand();
+  }
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  ssfs_vset_compression(volume, 1);
+  for(int i = 0; i < 2; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    ssfs_fwrite(file_id[i], data[i], sizeof(data[i]));
+    ssfs_fclose(file_id[i]); //files are compressed when closed
+  }
+  test_check_image(volume, image, err_no);
+  int used = used_data_blocks(image);
+  if(used >= 40){
+    fprintf(stderr, "Error: compressed files take %d blocks, as many as they have\n", used);
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 2; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+  }
+  //a write into the middle of a compressed extent, straddling two blocks
+  memset(data[0] + 3000, '#', 2000);
+  ssfs_fwseek(file_id[0], 3000);
+  ssfs_fwrite(file_id[0], data[0] + 3000, 2000);
+  test_read_back(file_id[0], 0, data[0], sizeof(data[0]), err_no);
+  for(int i = 0; i < 2; i++)
+    ssfs_fclose(file_id[i]);
+  test_check_image(volume, image, err_no);
+  volume = ssfs_mount(image, 0);
+  for(int i = 0; i < 2; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+    ssfs_fclose(file_id[i]);
+  }
+  test_check_image(volume, image, err_no);
+
+  volume = ssfs_mount(image, 0);
+  int fill_id = ssfs_vfopen(volume, "fill");
+  while(ssfs_fwrite(fill_id, data[1], 1024) == 1024);
+  file_id[0] = ssfs_vfopen(volume, names[0]);
+  ssfs_fwseek(file_id[0], 10*1024);
+  if(ssfs_fwrite(file_id[0], data[1], 2000) >= 0){
+    fprintf(stderr, "Error: a write into a compressed extent went through on a full volume\n");
+    *err_no += 1;
+  }
+  test_read_back(file_id[0], 0, data[0], sizeof(data[0]), err_no);
+  ssfs_fclose(file_id[0]);
+  ssfs_fclose(fill_id);
+  test_check_image(volume, image, err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Writes two identical files and a different one on a volume that deduplicates. The identical
+ones must share their blocks, a write to one of them must not show through the other, and
+removing one must leave the other whole.
+*/
+int test_dedup(int *err_no){
+  char *image = "dedup.img";
+  char *names[3] = {"original", "duplicate", "other"};
+  char data[3][10*1024];
+  int file_id[3];
+  for(int j = 0; j < sizeof(data[0]); j++){
+    data[0][j] = data[1][j] = 'a' + j/1024;
+    data[2][j] = 'A' + j/1024;
+  }
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  ssfs_vset_dedup(volume, 1);
+  for(int i = 0; i < 3; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    ssfs_fwrite(file_id[i], data[i], sizeof(data[i]));
+    ssfs_fclose(file_id[i]);
+  }
+  test_check_image(volume, image, err_no);
+  int used = used_data_blocks(image);
+  if(used != 20){
+    fprintf(stderr, "Error: two identical files and a different one take %d blocks instead of 20\n", used);
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  file_id[1] = ssfs_vfopen(volume, names[1]);
+  memset(data[1] + 4096, '#', 100);
+  ssfs_fwseek(file_id[1], 4096);
+  ssfs_fwrite(file_id[1], data[1] + 4096, 100);
+  ssfs_fclose(file_id[1]);
+  for(int i = 0; i < 3; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+    ssfs_fclose(file_id[i]);
+  }
+  ssfs_vremove(volume, names[0]);
+  test_check_image(volume, image, err_no);
+  used = used_data_blocks(image);
+  if(used != 20){
+    fprintf(stderr, "Error: after a write to a shared block and a remove, the files take %d blocks instead of 20\n", used);
+    *err_no += 1;
+  }
+  volume = ssfs_mount(image, 0);
+  for(int i = 1; i < 3; i++){
+    file_id[i] = ssfs_vfopen(volume, names[i]);
+    test_read_back(file_id[i], 0, data[i], sizeof(data[i]), err_no);
+    ssfs_fclose(file_id[i]);
+  }
+  test_check_image(volume, image, err_no);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Creates, stats and removes files in batches: short and long top-level names and paths in a
+directory. What a batch did must match what single calls see, before and after a remount.
+*/
+int test_batch_calls(int *err_no){
+  char *image = "batch.img";
+  int count = 60;
+  char *names[60];
+  int sizes[60];
+  for(int i = 0; i < count; i++){
+    names[i] = calloc(64, sizeof(char));
+    if(i%3 == 0) sprintf(names[i], "f%d", i);
+    else if(i%3 == 1) sprintf(names[i], "a_long_batch_created_file_name_%d", i);
+    else sprintf(names[i], "/batch/f%d", i);
+  }
+  int volume = ssfs_mount(image, SSFS_MOUNT_FRESH);
+  ssfs_vmkdir(volume, "batch");
+  int res = ssfs_vcreate_many(volume, names, count);
+  if(res != count){
+    fprintf(stderr, "Error: ssfs_vcreate_many created %d of %d files\n", res, count);
+    *err_no += 1;
+  }
+  //the second half gets i bytes each through single calls
+  for(int i = count/2; i < count; i++){
+    int file_id = ssfs_vfopen(volume, names[i]);
+    ssfs_fwrite(file_id, test_str, i);
+    ssfs_fclose(file_id);
+  }
+  res = ssfs_vstat_many(volume, names, count, sizes);
+  for(int i = 0; i < count; i++){
+    if(sizes[i] != (i < count/2 ? 0 : i)){
+      fprintf(stderr, "Error: ssfs_vstat_many gives %s %d bytes\n", names[i], sizes[i]);
+      *err_no += 1;
+    }
+  }
+  //removing every other file, half of them written to
+  char *removing[30];
+  for(int i = 0; i < count/2; i++)
+    removing[i] = names[2*i];
+  res = ssfs_vremove_many(volume, removing, count/2);
+  if(res != count/2){
+    fprintf(stderr, "Error: ssfs_vremove_many removed %d of %d files\n", res, count/2);
+    *err_no += 1;
+  }
+  test_check_image(volume, image, err_no);
+  volume = ssfs_mount(image, 0);
+  ssfs_vstat_many(volume, names, count, sizes);
+  for(int i = 0; i < count; i++){
+    int expected = i%2 == 0 ? -1 : (i < count/2 ? 0 : i);
+    if(sizes[i] != expected){
+      fprintf(stderr, "Error: after a remount, ssfs_vstat_many gives %s %d bytes instead of %d\n", names[i], sizes[i], expected);
+      *err_no += 1;
+    }
+    if(expected > 0){
+      int file_id = ssfs_vfopen(volume, names[i]);
+      test_read_back(file_id, 0, test_str, i, err_no);
+      ssfs_fclose(file_id);
+    }
+  }
+  test_check_image(volume, image, err_no);
+  free_name_element(names, count);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
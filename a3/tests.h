@@ -7,7 +7,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
 #include "sfs_api.h"
+#include "sfs_layout.h"
+#include "crc32c.h"
 
 /* The maximum file name length. We assume that filenames can contain
  * upper-case letters and periods ('.') characters. Feel free to
@@ -65,5 +70,23 @@ int test_overflow_open(int *file_id, int *file_sizes, int *write_ptr, char **fil
 //Test persistence
 int test_persistence(int *error, int write_length);
 
+//Feature tests, each on its own image
+int test_check_image(int volume, char *image, int *err_no);
+int fsck_image(char *options, char *image);
+int test_read_back(int file_id, int offset, char *expected, int length, int *err_no);
+int test_clone_after_dedup(int *err_no);
+int test_multiple_volumes(int *err_no);
+int test_checksums(int *err_no);
+int test_mmap(int *err_no);
+void image_block(char *image, int block, void *data, int write);
+int test_nested_directories(int *err_no);
+int used_data_blocks(char *image);
+int test_sparse_files(int *err_no);
+int test_truncate_and_holes(int *err_no);
+int test_defrag(int *err_no);
+int test_compression(int *err_no);
+int test_dedup(int *err_no);
+int test_batch_calls(int *err_no);
+
 //Help functionn
 int free_name_element(char **name_list, int num_file);